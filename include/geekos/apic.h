@@ -0,0 +1,45 @@
+/*
+ * Local and I/O APICs
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_APIC_H
+#define GEEKOS_APIC_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * Interrupt vectors raised by the local APIC.
+ * The spurious vector must have its low four bits set.
+ * The reschedule vector is sent between processors, to make
+ * one pick a new thread (see Make_Runnable() in kthread.c).
+ */
+#define LOCAL_TIMER_VECTOR 0xf0
+#define RESCHEDULE_VECTOR  0xf1
+#define SPURIOUS_VECTOR    0xff
+
+/*
+ * Interprocessor interrupt commands, for Send_IPI().
+ * Or the vector into IPI_FIXED, and the page number of
+ * the startup code into IPI_STARTUP.
+ */
+#define IPI_FIXED         0x04000
+#define IPI_INIT_ASSERT   0x0c500
+#define IPI_INIT_DEASSERT 0x08500
+#define IPI_STARTUP       0x04600
+
+void Init_Local_APIC(bool bootProcessor);
+uchar_t Get_Local_APIC_ID(void);
+uchar_t Get_Local_APIC_Version(void);
+void Local_APIC_EOI(void);
+bool Send_IPI(uchar_t apicId, ulong_t command);
+void Calibrate_Local_APIC_Timer(void);
+void Start_Local_APIC_Timer(void);
+void APIC_Delay(ulong_t us);
+
+void Init_IO_APIC(ushort_t irqMask);
+void Set_IO_APIC_Mask(ushort_t irqMask);
+
+#endif  /* GEEKOS_APIC_H */
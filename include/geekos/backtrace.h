@@ -0,0 +1,23 @@
+/*
+ * Stack unwinding using the frame pointer chain
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_BACKTRACE_H
+#define GEEKOS_BACKTRACE_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * Maximum number of frames Print_Backtrace() shows.
+ */
+#define MAX_BACKTRACE_DEPTH 16
+
+int Get_Backtrace(ulong_t ebp, ulong_t* frames, int maxFrames);
+int Get_Current_Backtrace(ulong_t* frames, int maxFrames);
+void Print_Backtrace(ulong_t ebp);
+void Print_Current_Backtrace(void);
+
+#endif  /* GEEKOS_BACKTRACE_H */
@@ -0,0 +1,56 @@
+/*
+ * Kernel microbenchmark harness
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_BENCH_H
+#define GEEKOS_BENCH_H
+
+#include <geekos/ktypes.h>
+#include <geekos/list.h>
+
+struct Benchmark;
+DEFINE_LIST(Benchmark_List, Benchmark);
+
+/*
+ * A benchmark.  run() performs the operation being measured
+ * the given number of times; the harness times each call and
+ * reports the cost per operation.  setup() and teardown(),
+ * if not null, are called before the first and after the last
+ * call to run(), and are not timed.
+ */
+struct Benchmark {
+    const char* name;
+    void (*run)(int iterations);
+    int iterations;
+    void (*setup)(void);
+    void (*teardown)(void);
+
+    DEFINE_LINK(Benchmark_List, Benchmark);
+};
+
+IMPLEMENT_LIST(Benchmark_List, Benchmark);
+
+/*
+ * Number of untimed runs before measuring,
+ * and number of timed runs.
+ */
+#define BENCH_WARMUP_RUNS 5
+#define BENCH_TIMED_RUNS 100
+
+/*
+ * I/O port of QEMU's isa-debug-exit device.  Run QEMU with
+ * "-device isa-debug-exit,iobase=0xf4,iosize=0x04" to make
+ * Exit_Emulator() work; QEMU then exits with status (code << 1) | 1.
+ */
+#define BENCH_EXIT_PORT 0xf4
+
+void Register_Benchmark(struct Benchmark* bench);
+int Run_Benchmarks(void);
+void Exit_Emulator(int code);
+
+void Init_Kernel_Benchmarks(void);
+
+#endif  /* GEEKOS_BENCH_H */
@@ -13,6 +13,11 @@
 struct Boot_Info {
     int bootInfoSize;	 /* size of this struct; for versioning */
     int memSizeKB;	 /* number of KB, as reported by int 15h */
+    int loadTicks;	 /* BIOS timer ticks (18.2 per second) taken
+			    by the boot sector to load the kernel */
+    unsigned long decompressCycles;
+			 /* TSC cycles taken by the setup code to
+			    decompress the kernel; 0 if it isn't compressed */
 };
 
 #endif  /* GEEKOS_BOOTINFO_H */
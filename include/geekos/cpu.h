@@ -0,0 +1,132 @@
+/*
+ * Access to miscellaneous x86 processor features
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_CPU_H
+#define GEEKOS_CPU_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * Read the low 32 bits of the processor's time stamp counter.
+ * The difference of two readings is correct (modulo 2^32)
+ * as long as the interval is shorter than 2^32 cycles,
+ * which is about a second on a fast processor.
+ */
+static __inline__ ulong_t Read_TSC(void)
+{
+    ulong_t low, high;
+
+    __asm__ __volatile__ (
+	"rdtsc"
+	: "=a" (low), "=d" (high)
+    );
+
+    return low;
+}
+
+/*
+ * Read the whole time stamp counter, for intervals
+ * too long for Read_TSC().
+ */
+static __inline__ unsigned long long Read_TSC_64(void)
+{
+    ulong_t low, high;
+
+    __asm__ __volatile__ (
+	"rdtsc"
+	: "=a" (low), "=d" (high)
+    );
+
+    return ((unsigned long long) high << 32) | low;
+}
+
+/*
+ * Execute the cpuid instruction for given leaf.
+ */
+static __inline__ void Read_CPUID(ulong_t leaf, ulong_t* eax, ulong_t* ebx, ulong_t* ecx, ulong_t* edx)
+{
+    __asm__ __volatile__ (
+	"cpuid"
+	: "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+	: "a" (leaf), "c" (0)
+    );
+}
+
+/*
+ * Read a model specific register.
+ */
+static __inline__ unsigned long long Read_MSR(ulong_t msr)
+{
+    ulong_t low, high;
+
+    __asm__ __volatile__ (
+	"rdmsr"
+	: "=a" (low), "=d" (high)
+	: "c" (msr)
+    );
+
+    return ((unsigned long long) high << 32) | low;
+}
+
+/*
+ * Write a model specific register.
+ */
+static __inline__ void Write_MSR(ulong_t msr, unsigned long long value)
+{
+    __asm__ __volatile__ (
+	"wrmsr"
+	:
+	: "c" (msr), "a" ((ulong_t) value), "d" ((ulong_t) (value >> 32))
+    );
+}
+
+/*
+ * Read a performance monitoring counter.
+ * Only the counter's width (see cpuid leaf 0xa) is significant.
+ */
+static __inline__ unsigned long long Read_PMC(ulong_t counter)
+{
+    ulong_t low, high;
+
+    __asm__ __volatile__ (
+	"rdpmc"
+	: "=a" (low), "=d" (high)
+	: "c" (counter)
+    );
+
+    return ((unsigned long long) high << 32) | low;
+}
+
+/*
+ * Feature bits returned in edx by cpuid leaf 1.
+ */
+#define CPUID_FEATURE_TSC  (1 << 4)
+#define CPUID_FEATURE_APIC (1 << 9)
+
+/*
+ * Divide a 64 bit value by a 32 bit one.
+ * We can't use long long division, since it needs runtime
+ * support, so use the divl instruction directly.  Saturates if
+ * the quotient doesn't fit in 32 bits.
+ */
+static __inline__ ulong_t Divide_64(ulong_t high, ulong_t low, ulong_t divisor)
+{
+    ulong_t quotient, remainder;
+
+    if (high >= divisor)
+	return 0xffffffffUL;
+
+    __asm__ (
+	"divl %4"
+	: "=a" (quotient), "=d" (remainder)
+	: "a" (low), "d" (high), "rm" (divisor)
+    );
+
+    return quotient;
+}
+
+#endif  /* GEEKOS_CPU_H */
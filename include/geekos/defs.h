@@ -29,6 +29,13 @@
  */
 #define KERNEL_START_ADDR 0x10000
 
+/*
+ * Page where the application processors start executing,
+ * in real mode (see trampoline.asm).  It must be below 1MB
+ * and page aligned.  Keep this up to date with defs.asm.
+ */
+#define AP_TRAMPOLINE_ADDR 0x8000
+
 /*
  * Kernel and user privilege levels
  */
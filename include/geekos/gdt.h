@@ -10,9 +10,12 @@
 #ifndef GEEKOS_GDT_H
 #define GEEKOS_GDT_H
 
+#include <geekos/ktypes.h>
+
 struct Segment_Descriptor;
 
 void Init_GDT(void);
+void Get_GDTR(ushort_t* limitAndBase);
 struct Segment_Descriptor* Allocate_Segment_Descriptor(void);
 void Free_Segment_Descriptor(struct Segment_Descriptor* desc);
 int Get_Descriptor_Index(struct Segment_Descriptor* desc);
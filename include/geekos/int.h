@@ -19,6 +19,7 @@
 #include <geekos/kassert.h>
 #include <geekos/ktypes.h>
 #include <geekos/defs.h>
+#include <geekos/spinlock.h>
 
 /*
  * This struct reflects the contents of the stack when
@@ -84,6 +85,19 @@ static __inline__ bool Is_User_Interrupt(struct Interrupt_State *state)
  */
 #define EFLAGS_IF (1 << 9)
 
+/*
+ * Cost accounting for one interrupt vector, updated by the
+ * interrupt entry code (Handle_Interrupt, in lowlevel.asm).
+ * It must be kept up to date with the offsets in "lowlevel.asm".
+ */
+struct Interrupt_Stats {
+    ulong_t count;		/* number of times the handler ran */
+    ulong_t totalCyclesLow;	/* total cycles spent in the handler */
+    ulong_t totalCyclesHigh;
+    ulong_t maxCycles;		/* longest single run of the handler */
+    ulong_t reschedules;	/* times a new thread was chosen on return */
+};
+
 /*
  * The signature of an interrupt handler.
  */
@@ -100,6 +114,26 @@ void Init_Interrupts(void);
  */
 bool Interrupts_Enabled(void);
 
+/*
+ * The kernel lock.  A processor holds it exactly when it has
+ * interrupts disabled, so disabling interrupts excludes the other
+ * processors too, and code written for one processor stays correct.
+ * Disable_Interrupts() and Enable_Interrupts() take and release it,
+ * as do the interrupt entry and return paths in lowlevel.asm.
+ */
+extern struct Spin_Lock g_kernelLock;
+
+/*
+ * Take the kernel lock.  When another processor holds it,
+ * the wait is counted in this processor's struct CPU.
+ */
+void Lock_Kernel_Contended(void);
+static __inline__ void Lock_Kernel(void)
+{
+    if (!Spin_Try_Lock(&g_kernelLock))
+	Lock_Kernel_Contended();
+}
+
 /*
  * Block interrupts.
  */
@@ -111,6 +145,7 @@ static __inline__ void __Disable_Interrupts(void)
 do {					\
     KASSERT(Interrupts_Enabled());	\
     __Disable_Interrupts();		\
+    Lock_Kernel();			\
 } while (0)
 
 /*
@@ -123,6 +158,7 @@ static __inline__ void __Enable_Interrupts(void)
 #define Enable_Interrupts()		\
 do {					\
     KASSERT(!Interrupts_Enabled());	\
+    Spin_Unlock(&g_kernelLock);		\
     __Enable_Interrupts();		\
 } while (0)
 
@@ -131,6 +167,13 @@ do {					\
  */
 void Dump_Interrupt_State(struct Interrupt_State* state);
 
+/*
+ * Interrupt handler cost statistics.
+ */
+void Get_Interrupt_Stats(int interrupt, struct Interrupt_Stats* stats);
+void Reset_Interrupt_Stats(void);
+void Dump_Interrupt_Stats(void);
+
 /**
  * Start interrupt-atomic region.
  * @return true if interrupts were enabled at beginning of call,
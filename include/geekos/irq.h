@@ -17,6 +17,7 @@ ushort_t Get_IRQ_Mask(void);
 void Set_IRQ_Mask(ushort_t mask);
 void Enable_IRQ(int irq);
 void Disable_IRQ(int irq);
+void Switch_To_IO_APIC(void);
 
 /*
  * IRQ handlers should call these to begin and end the
@@ -11,11 +11,12 @@
 #define GEEKOS_KASSERT_H
 
 #include <geekos/screen.h>
+#include <geekos/backtrace.h>
 
 #ifndef NDEBUG
 
 struct Kernel_Thread;
-extern struct Kernel_Thread* g_currentThread;
+struct Kernel_Thread* Get_Current(void);
 
 #define KASSERT(cond) 					\
 do {							\
@@ -24,7 +25,8 @@ do {							\
 	Print("Failed assertion in %s: %s at %s, line %d, RA=%lx, thread=%p\n",\
 		__func__, #cond, __FILE__, __LINE__,	\
 		(ulong_t) __builtin_return_address(0),	\
-		g_currentThread);			\
+		Get_Current());				\
+	Print_Current_Backtrace();			\
 	while (1)					\
 	   ; 						\
     }							\
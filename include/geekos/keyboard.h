@@ -92,6 +92,20 @@ typedef ushort_t Keycode;
 #define KEY_SCRLOCK _SPECIAL(22)
 #define KEY_SYSREQ  _SPECIAL(23)
 
+/*
+ * Extended (0xE0-prefixed) navigation keys
+ */
+#define KEY_UP      _SPECIAL(24)
+#define KEY_DOWN    _SPECIAL(25)
+#define KEY_LEFT    _SPECIAL(26)
+#define KEY_RIGHT   _SPECIAL(27)
+#define KEY_HOME    _SPECIAL(28)
+#define KEY_END     _SPECIAL(29)
+#define KEY_PGUP    _SPECIAL(30)
+#define KEY_PGDN    _SPECIAL(31)
+#define KEY_INSERT  _SPECIAL(32)
+#define KEY_DELETE  _SPECIAL(33)
+
 /*
  * Keypad keys
  */
@@ -119,12 +133,59 @@ typedef ushort_t Keycode;
 
 #ifdef GEEKOS
 
+/*
+ * Editor commands, as classified by Get_From_Keyboard().
+ */
+typedef enum {
+    COMMAND_NO_OPERATION = 0,
+    COMMAND_MOVE_UP,
+    COMMAND_MOVE_DOWN,
+    COMMAND_MOVE_LEFT,
+    COMMAND_MOVE_RIGHT,
+    COMMAND_HOME,
+    COMMAND_END,
+    COMMAND_PAGE_UP,
+    COMMAND_PAGE_DOWN,
+    COMMAND_CTRL_D,
+    COMMAND_CTRL_P,
+    COMMAND_F1,
+    COMMAND_F2,
+    COMMAND_F3,
+    COMMAND_F4,
+    COMMAND_F5,
+    COMMAND_F6,
+    COMMAND_F7,
+    COMMAND_F8,
+    COMMAND_F9,
+    COMMAND_F10,
+    COMMAND_F11,
+    COMMAND_F12,
+    COMMAND_DELETE,
+    COMMAND_BACKSPACE,
+    COMMAND_SCROLL_LOCK,
+} COMMAND_TYPE;
+
+/*
+ * A keycode, stamped with the time its interrupt arrived.
+ */
+struct Key_Event {
+    Keycode keycode;
+    ulong_t ticks;		/* value of g_numTicks */
+    ulong_t tsc;		/* low 32 bits of the time stamp counter */
+};
+
 /*
  * Public functions
  */
 void Init_Keyboard(void);
 bool Read_Key(Keycode* keycode);
+int Read_Keys(Keycode* buf, int max);
+bool Read_Key_Event(struct Key_Event* event);
 Keycode Wait_For_Key(void);
+Keycode Get_From_Keyboard(COMMAND_TYPE* type);
+ulong_t Get_Key_Overflow_Count(void);
+void Record_Key_Latency(void);
+void Dump_Keyboard_Stats(void);
 
 #endif  /* GEEKOS */
 
@@ -12,10 +12,13 @@
 
 #include <geekos/ktypes.h>
 #include <geekos/list.h>
+#include <geekos/perfctr.h>
+#include <geekos/smp.h>
 
 struct Kernel_Thread;
 struct User_Context;
 struct Interrupt_State;
+struct Mutex;
 
 /*
  * Queue of threads.
@@ -24,11 +27,26 @@ struct Interrupt_State;
  */
 DEFINE_LIST(Thread_Queue, Kernel_Thread);
 
+/*
+ * Static initializer for an empty Thread_Queue.
+ */
+#define THREAD_QUEUE_INITIALIZER { 0, 0 }
+
 /*
  * List which includes all threads.
  */
 DEFINE_LIST(All_Thread_List, Kernel_Thread);
 
+/*
+ * List of threads waiting with a timeout.
+ */
+DEFINE_LIST(Timeout_List, Kernel_Thread);
+
+/*
+ * List of mutexes held by a thread (see synch.c).
+ */
+DEFINE_LIST(Held_Mutex_List, Mutex);
+
 /*
  * Kernel thread context data structure.
  * NOTE: there is assembly code in lowlevel.asm that depends
@@ -38,7 +56,7 @@ DEFINE_LIST(All_Thread_List, Kernel_Thread);
 struct Kernel_Thread {
     ulong_t esp;			 /* offset 0 */
     volatile ulong_t numTicks;		 /* offset 4 */
-    int priority;
+    int priority;			 /* Effective priority */
     DEFINE_LINK(Thread_Queue, Kernel_Thread);
     void* stackPage;
     struct User_Context* userContext;
@@ -53,6 +71,43 @@ struct Kernel_Thread {
     /* The kernel thread id; also used as process id */
     int pid;
 
+    /*
+     * These fields are used for priority inheritance.
+     * The effective priority is raised above basePriority
+     * while a higher priority thread waits for a mutex
+     * this thread holds.
+     */
+    int basePriority;
+    struct Mutex* blockedOn;
+    struct Held_Mutex_List heldMutexes;
+
+    /*
+     * These fields are used by the fair-share scheduler.
+     * vruntime is the time the thread has run, in cycles,
+     * scaled down for higher priorities.
+     */
+    unsigned long long vruntime;
+    bool fairQueued;
+    struct Kernel_Thread *fairLeft, *fairRight;
+
+    /*
+     * These fields are used to place the thread on a processor.
+     * cpu is the processor whose run queue holds the thread,
+     * or that last ran it; affinity is a mask of the processors
+     * it may run on.
+     */
+    int cpu;
+    ulong_t affinity;
+
+    /* These fields are used to implement Wait_Timeout() */
+    ulong_t wakeupTick;
+    struct Thread_Queue* timeoutQueue;
+    bool timedOut;
+    DEFINE_LINK(Timeout_List, Kernel_Thread);
+
+    /* Hardware events counted while the thread was running */
+    struct Perf_Counts perf;
+
     /* Link fields for list of all threads in the system. */
     DEFINE_LINK(All_Thread_List, Kernel_Thread);
 
@@ -67,6 +122,7 @@ struct Kernel_Thread {
  */
 IMPLEMENT_LIST(Thread_Queue, Kernel_Thread);
 IMPLEMENT_LIST(All_Thread_List, Kernel_Thread);
+IMPLEMENT_LIST(Timeout_List, Kernel_Thread);
 
 static __inline__ void Enqueue_Thread(struct Thread_Queue *queue, struct Kernel_Thread *kthread) {
     Add_To_Back_Of_Thread_Queue(queue, kthread);
@@ -89,6 +145,23 @@ typedef void (*Thread_Start_Func)(ulong_t arg);
 #define PRIORITY_LOW     2
 #define PRIORITY_NORMAL  5
 #define PRIORITY_HIGH   10
+#define NUM_PRIORITY_LEVELS (PRIORITY_HIGH + 1)
+
+/*
+ * Scheduling policies.
+ * SCHED_PRIORITY always runs the highest priority runnable thread,
+ * round robin within a priority level.
+ * SCHED_FAIR runs the thread with the least weighted virtual
+ * runtime, where priority determines the weight, so every thread
+ * gets a share of the CPU.  Idle threads are only run
+ * when nothing else can run under either policy.
+ */
+enum Sched_Policy { SCHED_PRIORITY, SCHED_FAIR };
+
+/*
+ * Policy in effect.  Can only be changed before Init_Scheduler().
+ */
+extern enum Sched_Policy g_schedPolicy;
 
 
 /*
@@ -104,12 +177,18 @@ struct Kernel_Thread* Start_Kernel_Thread(
 struct Kernel_Thread* Start_User_Thread(struct User_Context* userContext, bool detached);
 void Make_Runnable(struct Kernel_Thread* kthread);
 void Make_Runnable_Atomic(struct Kernel_Thread* kthread);
+void Set_Effective_Priority(struct Kernel_Thread* kthread, int priority);
 struct Kernel_Thread* Get_Current(void);
+bool Runs_Ahead_Of_Current(struct Kernel_Thread* kthread);
+bool Is_Thread_Running(struct Kernel_Thread* kthread);
+int Set_Affinity(struct Kernel_Thread* kthread, ulong_t affinity);
 struct Kernel_Thread* Get_Next_Runnable(void);
 void Schedule(void);
 void Yield(void);
 void Exit(int exitCode) __attribute__ ((noreturn));
 int Join(struct Kernel_Thread* kthread);
+struct Kernel_Thread* Create_Idle_Thread(void);
+void Start_AP_Scheduler(void) __attribute__ ((noreturn));
 struct Kernel_Thread* Lookup_Thread(int pid);
 
 /*
@@ -121,23 +200,36 @@ void Switch_To_Thread(struct Kernel_Thread*);
  * Wait queue functions.
  */
 void Wait(struct Thread_Queue* waitQueue);
+bool Wait_Timeout(struct Thread_Queue* waitQueue, ulong_t ticks);
+void Wake_Expired_Timeouts(void);
 void Wake_Up(struct Thread_Queue* waitQueue);
-void Wake_Up_One(struct Thread_Queue* waitQueue);
+struct Kernel_Thread* Wake_Up_One(struct Thread_Queue* waitQueue);
+
+/*
+ * Pointer to the thread executing on this processor.
+ */
+#define g_currentThread (Get_CPU()->currentThread)
 
 /*
- * Pointer to currently executing thread.
+ * Boolean flag indicating that this processor needs to choose
+ * a new runnable thread.
  */
-extern struct Kernel_Thread* g_currentThread;
+#define g_needReschedule (Get_CPU()->needReschedule)
 
 /*
- * Boolean flag indicating that we need to choose a new runnable thread.
+ * Boolean flag indicating that preemption should be disabled
+ * on this processor.
  */
-extern int g_needReschedule;
+#define g_preemptionDisabled (Get_CPU()->preemptionDisabled)
 
 /*
- * Boolean flag indicating that preemption should be disabled.
+ * Number of times a different thread was chosen to run,
+ * threads taken from another processor's run queue,
+ * and reschedule interrupts sent.
  */
-extern volatile int g_preemptionDisabled;
+extern ulong_t g_numContextSwitches;
+extern ulong_t g_numThreadsStolen;
+extern ulong_t g_numReschedIPIs;
 
 /*
  * Thread-local data information
@@ -153,6 +245,8 @@ extern void *Tlocal_Get(tlocal_key_t);
 
 /* Print list of all threads, for debugging. */
 extern void Dump_All_Thread_List(void);
+extern void Dump_Thread_Perf_Counts(void);
+extern void Dump_Scheduler_Stats(void);
 
 
 #endif  /* GEEKOS_KTHREAD_H */
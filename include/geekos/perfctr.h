@@ -0,0 +1,44 @@
+/*
+ * Hardware performance counters
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_PERFCTR_H
+#define GEEKOS_PERFCTR_H
+
+#include <geekos/ktypes.h>
+
+struct Kernel_Thread;
+
+/*
+ * The architectural events we count.
+ */
+enum Perf_Event {
+    PERF_CYCLES,		/* Unhalted core cycles */
+    PERF_INSTRUCTIONS,		/* Instructions retired */
+    PERF_LLC_MISSES,		/* Last level cache misses */
+    PERF_BRANCH_MISSES,		/* Mispredicted branches retired */
+    NUM_PERF_EVENTS
+};
+
+/*
+ * Event counts.  Each thread accumulates the counts for the
+ * time it has spent on the CPU.  Events the processor can't
+ * count stay at zero.
+ */
+struct Perf_Counts {
+    unsigned long long count[NUM_PERF_EVENTS];
+};
+
+void Init_Perf_Counters(void);
+void Init_AP_Perf_Counters(void);
+bool Perf_Counters_Present(void);
+bool Perf_Event_Present(enum Perf_Event event);
+const char* Get_Perf_Event_Name(enum Perf_Event event);
+void Perf_Charge(struct Kernel_Thread* kthread);
+void Get_Thread_Perf_Counts(struct Kernel_Thread* kthread, struct Perf_Counts* counts);
+ulong_t Perf_Ratio(unsigned long long num, unsigned long long den, ulong_t scale);
+
+#endif  /* GEEKOS_PERFCTR_H */
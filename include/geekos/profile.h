@@ -0,0 +1,38 @@
+/*
+ * Timer-driven sampling profiler
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_PROFILE_H
+#define GEEKOS_PROFILE_H
+
+#include <geekos/ktypes.h>
+
+struct Interrupt_State;
+
+/*
+ * Number of distinct call stacks we can count.
+ * Samples with stacks that don't fit are counted as dropped.
+ */
+#define PROFILE_TABLE_BITS 10
+#define PROFILE_TABLE_SIZE (1 << PROFILE_TABLE_BITS)
+
+/*
+ * Maximum number of frames recorded per sample,
+ * including the sampled address itself.
+ */
+#define PROFILE_MAX_DEPTH 8
+
+/*
+ * Default sampling interval, in timer ticks.
+ */
+#define DEFAULT_PROFILE_INTERVAL 1
+
+void Profile_Tick(struct Interrupt_State* state);
+void Set_Profile_Interval(int ticks);
+void Reset_Profile(void);
+void Dump_Profile(void);
+
+#endif  /* GEEKOS_PROFILE_H */
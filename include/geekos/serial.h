@@ -0,0 +1,68 @@
+/*
+ * Serial port (16550 UART) driver
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SERIAL_H
+#define GEEKOS_SERIAL_H
+
+#include <geekos/ktypes.h>
+
+/* ----------------------------------------------------------------------
+ * Hardware stuff
+ * ---------------------------------------------------------------------- */
+
+#define COM1_IRQ 4
+#define COM1_BASE 0x3F8
+
+/*
+ * UART registers, as offsets from the base port
+ */
+#define UART_DATA 0		/* Transmit/receive buffer; divisor low if DLAB */
+#define UART_IER  1		/* Interrupt enable; divisor high if DLAB */
+#define UART_IIR  2		/* Interrupt identification (read) */
+#define UART_FCR  2		/* FIFO control (write) */
+#define UART_LCR  3		/* Line control */
+#define UART_MCR  4		/* Modem control */
+#define UART_LSR  5		/* Line status */
+#define UART_SCRATCH 7
+
+/*
+ * Register bits
+ */
+#define UART_IER_THRE     0x02	/* Interrupt when transmit holding register empty */
+#define UART_FCR_ENABLE   0x01
+#define UART_FCR_CLEAR    0x06	/* Clear receive and transmit FIFOs */
+#define UART_FCR_TRIG_14  0xC0
+#define UART_IIR_FIFO     0xC0	/* Both set if FIFOs are enabled and working */
+#define UART_LCR_8N1      0x03
+#define UART_LCR_DLAB     0x80	/* Divisor latch access */
+#define UART_MCR_DTR      0x01
+#define UART_MCR_RTS      0x02
+#define UART_MCR_OUT2     0x08	/* Must be set for the UART to raise interrupts */
+#define UART_LSR_THRE     0x20	/* Transmit holding register (and FIFO) empty */
+#define UART_LSR_TEMT     0x40	/* Transmitter completely idle */
+
+#define UART_CLOCK 115200
+#define UART_FIFO_SIZE 16
+
+/* ----------------------------------------------------------------------
+ * Functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * If set, everything written to the screen
+ * is also sent to the serial port.
+ */
+extern bool g_serialMirror;
+
+void Init_Serial(void);
+bool Serial_Present(void);
+void Serial_Put_Char(int c);
+void Serial_Put_Buf(const char* buf, ulong_t length);
+void Serial_Print(const char* fmt, ...) __attribute__ ((format (printf, 1, 2)));
+void Serial_Flush(void);
+
+#endif  /* GEEKOS_SERIAL_H */
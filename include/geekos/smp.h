@@ -0,0 +1,76 @@
+/*
+ * Multiprocessor support
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SMP_H
+#define GEEKOS_SMP_H
+
+#include <geekos/ktypes.h>
+
+struct Kernel_Thread;
+
+#define MAX_CPUS 16
+
+/*
+ * Processor mask allowing a thread to run anywhere (see Set_Affinity()).
+ */
+#define ALL_CPUS (~0UL)
+
+/*
+ * Per-CPU data.  Each processor's fs segment register selects
+ * its own struct CPU, so Get_CPU() always finds the one for the
+ * processor it runs on.  The first four fields are used by
+ * lowlevel.asm; keep the offsets there up to date.
+ */
+struct CPU {
+    struct CPU* self;
+    struct Kernel_Thread* currentThread;
+    int needReschedule;
+    volatile int preemptionDisabled;
+
+    int id;			/* Index in the CPU table; the boot processor is 0 */
+    uchar_t apicId;		/* Local APIC id */
+    uchar_t apicVersion;
+    volatile bool online;	/* Set once the processor is scheduling threads */
+    ushort_t selector;		/* Selector for the segment in fs */
+    struct Kernel_Thread* idleThread;
+    ulong_t lastChargeTSC;	/* When the current thread was last charged (SCHED_FAIR) */
+    ulong_t kernelLockWaits;	/* Times the kernel lock was held by another processor */
+    unsigned long long kernelLockWaitCycles;	/* Cycles spent waiting for it */
+};
+
+/*
+ * Get the per-CPU data of the processor we're running on.
+ * A thread can move to another processor whenever it is preempted
+ * or blocks, so don't hold on to the result across either.
+ */
+static __inline__ struct CPU* Get_CPU(void)
+{
+    struct CPU* cpu;
+
+    __asm__ __volatile__ ("movl %%fs:0, %0" : "=r" (cpu));
+    return cpu;
+}
+
+/*
+ * Routing of an ISA IRQ to an I/O APIC input pin.
+ */
+struct ISA_IRQ_Route {
+    uchar_t pin;
+    bool activeLow;
+    bool levelTriggered;
+};
+
+void Init_SMP(void);
+void Start_APs(void);
+int Get_Num_CPUs(void);
+int Get_Num_Online_CPUs(void);
+struct CPU* Get_CPU_By_Index(int cpu);
+ulong_t Get_Local_APIC_Address(void);
+ulong_t Get_IO_APIC_Address(void);
+const struct ISA_IRQ_Route* Get_ISA_IRQ_Route(int irq);
+
+#endif  /* GEEKOS_SMP_H */
@@ -0,0 +1,60 @@
+/*
+ * Spin locks
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_SPINLOCK_H
+#define GEEKOS_SPINLOCK_H
+
+#include <geekos/ktypes.h>
+
+/*
+ * A spin lock provides mutual exclusion between processors.
+ * Critical sections protected by a spin lock must be short,
+ * and must not sleep.  The kernel lock (see int.h) is the only
+ * one so far.
+ */
+struct Spin_Lock {
+    volatile int locked;
+};
+
+#define SPIN_LOCK_INITIALIZER { 0 }
+
+static __inline__ void Spin_Lock_Init(struct Spin_Lock* lock)
+{
+    lock->locked = 0;
+}
+
+static __inline__ bool Spin_Try_Lock(struct Spin_Lock* lock)
+{
+    int old = 1;
+
+    /* xchg with a memory operand is implicitly locked */
+    __asm__ __volatile__ (
+	"xchgl %0, %1"
+	: "+r" (old), "+m" (lock->locked)
+	:
+	: "memory"
+    );
+
+    return old == 0;
+}
+
+static __inline__ void Spin_Lock(struct Spin_Lock* lock)
+{
+    while (!Spin_Try_Lock(lock)) {
+	/* Wait for it to look free before trying again */
+	while (lock->locked)
+	    __asm__ __volatile__ ("pause" : : : "memory");
+    }
+}
+
+static __inline__ void Spin_Unlock(struct Spin_Lock* lock)
+{
+    __asm__ __volatile__ ("" : : : "memory");
+    lock->locked = 0;
+}
+
+#endif  /* GEEKOS_SPINLOCK_H */
@@ -17,27 +17,118 @@
  */
 enum { MUTEX_UNLOCKED, MUTEX_LOCKED };
 
+/*
+ * Number of return addresses kept for the longest wait.
+ */
+#define MUTEX_STACK_DEPTH 4
+
+/*
+ * Contention statistics, kept for every mutex.
+ * Cycle counts come from the time stamp counter.
+ */
+struct Mutex_Stats {
+    ulong_t acquisitions;
+    ulong_t contended;		/* Acquisitions that found the mutex locked */
+    ulong_t yields;		/* Times a contended locker yielded to the owner */
+    ulong_t spins;		/* Times it spun while the owner ran on another CPU */
+    ulong_t sleeps;		/* Times a contended locker slept in the wait queue */
+    ulong_t boosts;		/* Times the owner inherited a waiter's priority */
+    unsigned long long waitCycles;
+    ulong_t maxWaitCycles;
+    ulong_t maxHoldCycles;
+    ulong_t maxWaitStack[MUTEX_STACK_DEPTH];	/* Where the longest wait happened */
+};
+
+/*
+ * Number of times a thread will yield to (or spin waiting for)
+ * the owner of a locked mutex before sleeping (see Mutex_Lock()).
+ */
+#define MUTEX_DEFAULT_YIELDS 4
+
+struct Mutex;
+DEFINE_LIST(Mutex_List, Mutex);
+
 struct Mutex {
     int state;
     struct Kernel_Thread* owner;
     struct Thread_Queue waitQueue;
+    int maxYields;
+
+    ulong_t lockTSC;		/* When the current owner acquired it */
+    struct Mutex_Stats stats;
+
+    /* Name and link for registered mutexes */
+    const char* name;
+    DEFINE_LINK(Mutex_List, Mutex);
+
+    /* Link in the owner's list of held mutexes */
+    DEFINE_LINK(Held_Mutex_List, Mutex);
 };
 
-#define MUTEX_INITIALIZER { MUTEX_UNLOCKED, 0, THREAD_QUEUE_INITIALIZER }
+IMPLEMENT_LIST(Held_Mutex_List, Mutex);
+
+#define MUTEX_INITIALIZER { MUTEX_UNLOCKED, 0, THREAD_QUEUE_INITIALIZER, MUTEX_DEFAULT_YIELDS }
 
 struct Condition {
     struct Thread_Queue waitQueue;
+    struct Mutex* mutex;	/* Mutex passed to the last Cond_Wait() */
 };
 
+/*
+ * If set, Cond_Broadcast() moves waiters straight to the wait
+ * queue of the (locked) mutex guarding the condition, rather
+ * than waking them all to contend for it.
+ */
+extern bool g_waitMorphing;
+
 void Mutex_Init(struct Mutex* mutex);
 void Mutex_Lock(struct Mutex* mutex);
 void Mutex_Unlock(struct Mutex* mutex);
+void Mutex_Set_Max_Yields(struct Mutex* mutex, int maxYields);
+void Mutex_Register(struct Mutex* mutex, const char* name);
+void Mutex_Unregister(struct Mutex* mutex);
+void Dump_Lock_Stats(void);
+
+/*
+ * Reader-writer lock.
+ * Any number of readers, or a single writer, may hold the lock.
+ * Writers are preferred: once a writer is waiting, new readers
+ * wait too, and when a writer releases the lock, all waiting
+ * readers are admitted together unless another writer is waiting.
+ */
+struct RWLock {
+    int readers;		/* Number of readers holding the lock */
+    bool writer;		/* True if a writer holds the lock */
+    int waitingWriters;		/* Writers waiting (or woken, but not yet running) */
+    struct Thread_Queue readQueue;
+    struct Thread_Queue writeQueue;
+};
+
+/*
+ * Counting semaphore.
+ */
+struct Semaphore {
+    int count;
+    struct Thread_Queue waitQueue;
+};
 
 void Cond_Init(struct Condition* cond);
 void Cond_Wait(struct Condition* cond, struct Mutex* mutex);
 void Cond_Signal(struct Condition* cond);
 void Cond_Broadcast(struct Condition* cond);
 
+void RWLock_Init(struct RWLock* rwlock);
+void Read_Lock(struct RWLock* rwlock);
+void Read_Unlock(struct RWLock* rwlock);
+void Write_Lock(struct RWLock* rwlock);
+void Write_Unlock(struct RWLock* rwlock);
+
+void Sem_Init(struct Semaphore* sem, int count);
+void Sem_P(struct Semaphore* sem);
+bool Sem_Try_P(struct Semaphore* sem);
+bool Sem_Timed_P(struct Semaphore* sem, ulong_t ticks);
+void Sem_V(struct Semaphore* sem);
+
 #define IS_HELD(mutex) \
     ((mutex)->state == MUTEX_LOCKED && (mutex)->owner == g_currentThread)
 
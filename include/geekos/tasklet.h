@@ -0,0 +1,49 @@
+/*
+ * Deferred interrupt work (tasklets)
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_TASKLET_H
+#define GEEKOS_TASKLET_H
+
+#include <geekos/ktypes.h>
+#include <geekos/list.h>
+
+struct Interrupt_State;
+struct Tasklet;
+
+/*
+ * A tasklet is the "bottom half" of an interrupt handler.
+ * The handler (the "top half") acknowledges the hardware,
+ * captures whatever data it must, and schedules a tasklet.
+ * Pending tasklets run on the way out of the interrupt,
+ * after the handler has returned, with interrupts enabled.
+ *
+ * Tasklets never run concurrently with each other, and
+ * a thread switch can't happen while one is running.
+ * A tasklet must not sleep.
+ */
+typedef void (*Tasklet_Func)(ulong_t arg);
+
+DEFINE_LIST(Tasklet_List, Tasklet);
+
+struct Tasklet {
+    Tasklet_Func func;
+    ulong_t arg;
+    bool pending;
+    DEFINE_LINK(Tasklet_List, Tasklet);
+};
+
+IMPLEMENT_LIST(Tasklet_List, Tasklet);
+
+void Init_Tasklet(struct Tasklet* tasklet, Tasklet_Func func, ulong_t arg);
+void Schedule_Tasklet(struct Tasklet* tasklet);
+
+/*
+ * Called from the interrupt return code in lowlevel.asm.
+ */
+void Run_Tasklets(struct Interrupt_State* state);
+
+#endif  /* GEEKOS_TASKLET_H */
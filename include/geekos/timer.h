@@ -12,13 +12,20 @@
 
 #define TIMER_IRQ 0
 
-extern volatile ulong_t g_numTicks;
+/*
+ * Length of a PIT tick (65536 / 1193182 seconds), in microseconds.
+ */
+#define US_PER_PIT_TICK 54925
 
-void Init_Timer(void);
+struct Interrupt_State;
 
-void Micro_Delay(int us);
+extern volatile ulong_t g_numTicks;
+extern int g_Quantum;
 
+void Init_Timer(void);
+void Charge_Timer_Tick(struct Interrupt_State* state);
 
 void Micro_Delay(int us);
+ulong_t Cycles_To_Us(ulong_t cycles);
 
 #endif  /* GEEKOS_TIMER_H */
@@ -0,0 +1,99 @@
+/*
+ * Kernel event tracing
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_TRACE_H
+#define GEEKOS_TRACE_H
+
+#include <geekos/ktypes.h>
+#include <geekos/cpu.h>
+#include <geekos/smp.h>
+
+/*
+ * Trace events.  scripts/decodetrace knows these numbers,
+ * so add new events at the end, and update it too.
+ */
+enum {
+    TRACE_NONE,
+    TRACE_SCHEDULE,		/* a = pid giving up the CPU */
+    TRACE_SWITCH,		/* a = pid switched from, b = pid switched to */
+    TRACE_WAKE_UP,		/* a = pid woken, b = wait queue */
+    TRACE_MUTEX_LOCK,		/* a = mutex, b = cycles spent waiting */
+    TRACE_MUTEX_UNLOCK,		/* a = mutex */
+    TRACE_MALLOC,		/* a = size, b = address */
+    TRACE_FREE,			/* a = address */
+    TRACE_IRQ_ENTER,		/* a = irq */
+    TRACE_IRQ_EXIT,		/* a = irq */
+    TRACE_STEAL,		/* a = pid taken, b = processor taken from */
+    NUM_TRACE_EVENTS
+};
+
+/*
+ * A trace record.  Records are written into a ring buffer,
+ * overwriting the oldest ones when it's full.
+ */
+struct Trace_Record {
+    ulong_t tsc;
+    ushort_t event;
+    ushort_t cpu;
+    ulong_t a, b;
+};
+
+/*
+ * Number of records kept (a power of two).
+ */
+#define TRACE_BUFFER_SIZE 1024
+#define TRACE_BUFFER_MASK (TRACE_BUFFER_SIZE - 1)
+
+/*
+ * The trace buffer, shared by all processors.
+ * g_traceNext is the total number of records ever written.
+ */
+extern struct Trace_Record g_traceBuffer[TRACE_BUFFER_SIZE];
+extern volatile ulong_t g_traceNext;
+extern volatile bool g_traceEnabled;
+
+/*
+ * Record an event.  Safe to use anywhere, including
+ * interrupt handlers: the slot is claimed with a single locked
+ * xadd instruction, so neither an interrupt nor another
+ * processor can get the same one.
+ */
+static __inline__ void Trace(ulong_t event, ulong_t a, ulong_t b)
+{
+    struct Trace_Record* rec;
+    ulong_t index = 1;
+
+    if (!g_traceEnabled)
+	return;
+
+    __asm__ __volatile__ (
+	"lock; xaddl %0, %1"
+	: "+r" (index), "+m" (g_traceNext)
+	:
+	: "memory"
+    );
+
+    rec = &g_traceBuffer[index & TRACE_BUFFER_MASK];
+    rec->tsc = Read_TSC();
+    rec->event = event;
+    rec->cpu = Get_CPU()->id;
+    rec->a = a;
+    rec->b = b;
+}
+
+/*
+ * Tracepoints compile to nothing if NO_TRACE is defined.
+ */
+#ifdef NO_TRACE
+#  define TRACE(event, a, b) ((void) 0)
+#else
+#  define TRACE(event, a, b) Trace((event), (ulong_t) (a), (ulong_t) (b))
+#endif
+
+void Dump_Trace(void);
+
+#endif  /* GEEKOS_TRACE_H */
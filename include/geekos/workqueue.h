@@ -0,0 +1,71 @@
+/*
+ * Kernel work queues
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_WORKQUEUE_H
+#define GEEKOS_WORKQUEUE_H
+
+#include <geekos/ktypes.h>
+#include <geekos/list.h>
+#include <geekos/synch.h>
+
+struct Work_Item;
+struct Work_Queue;
+
+/*
+ * A work queue hands off function calls to a fixed pool of
+ * worker threads, so that short background jobs don't need
+ * a thread of their own.  Work items are owned by the caller,
+ * and double as completion handles: Wait_For_Work() blocks
+ * until the item's function has returned.
+ *
+ * Work queues use mutexes, so they may only be used from
+ * kernel threads with interrupts enabled (not from interrupt
+ * handlers or tasklets).
+ */
+typedef void (*Work_Func)(ulong_t arg);
+
+DEFINE_LIST(Work_List, Work_Item);
+
+struct Work_Item {
+    Work_Func func;
+    ulong_t arg;
+    struct Work_Queue* queue;	/* Queue it was last submitted to */
+    bool pending;		/* Submitted, and not yet finished */
+    struct Condition done;
+    DEFINE_LINK(Work_List, Work_Item);
+};
+
+IMPLEMENT_LIST(Work_List, Work_Item);
+
+struct Work_Queue {
+    const char* name;
+    int priority;
+    int numWorkers;
+    struct Kernel_Thread** workers;
+
+    struct Mutex lock;
+    struct Condition workAvailable;
+    struct Work_List pendingList;
+    bool shutdown;
+
+    ulong_t numQueued, numCompleted;
+};
+
+/*
+ * Default queue for miscellaneous background work.
+ */
+extern struct Work_Queue* g_systemWorkQueue;
+
+void Init_Work_Queues(void);
+struct Work_Queue* Create_Work_Queue(const char* name, int numWorkers, int priority);
+void Destroy_Work_Queue(struct Work_Queue* queue);
+
+void Init_Work(struct Work_Item* work, Work_Func func, ulong_t arg);
+void Queue_Work(struct Work_Queue* queue, struct Work_Item* work);
+void Wait_For_Work(struct Work_Item* work);
+
+#endif  /* GEEKOS_WORKQUEUE_H */
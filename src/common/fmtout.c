@@ -20,6 +20,10 @@
  *    supported type.  Arithmetic on 64 bit types requires runtime support
  *    (at least on x86).
  *
+ * 4. Convert decimal numbers two digits at a time and hex and octal
+ *    numbers with shifts, and skip the format state machine for plain
+ *    %d, %i, %u, %x and %s conversions.
+ *
  * See the file LICENSE-klibc for license information.
  */
 
@@ -78,7 +82,7 @@ enum ranks {
 #define PTRDIFF_T_RANK	rank_long
 
 /* DHH */
-#define EMIT(x) do { (q)->Emit((q), (x)); } while (0)
+#define EMIT(x) do { (q)->Emit((q), (x)); ++o; } while (0)
 
 /*
  * DHH - As a hack, we buffer this many digits when generating
@@ -93,37 +97,134 @@ enum ranks {
  */
 #define NDIGITS_MAX 43
 
+static const char lcdigits[] = "0123456789abcdef";
+static const char ucdigits[] = "0123456789ABCDEF";
+
+/* Two digit strings for 0..99 */
+static const char decimal_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/*
+ * Convert a number to digits, storing them backwards ending just
+ * before end.  Returns the number of digits, which is zero for 0.
+ */
+static int
+convert_digits(char *end, uintmax_t val, int base, const char *digits)
+{
+  char *qq = end;
+  const char *pair;
+
+  switch ( base ) {
+  case 16:
+    while ( val ) {
+      *--qq = digits[val & 15];
+      val >>= 4;
+    }
+    break;
+  case 8:
+    while ( val ) {
+      *--qq = digits[val & 7];
+      val >>= 3;
+    }
+    break;
+  case 10:
+    /* One division per pair of digits */
+    while ( val >= 100 ) {
+      pair = &decimal_pairs[(val % 100) * 2];
+      val /= 100;
+      qq -= 2;
+      qq[0] = pair[0];
+      qq[1] = pair[1];
+    }
+    if ( val >= 10 ) {
+      pair = &decimal_pairs[val * 2];
+      qq -= 2;
+      qq[0] = pair[0];
+      qq[1] = pair[1];
+    } else if ( val ) {
+      *--qq = '0' + val;
+    }
+    break;
+  default:
+    while ( val ) {
+      *--qq = digits[val % base];
+      val /= base;
+    }
+    break;
+  }
+
+  return end - qq;
+}
+
+/*
+ * Emit a number with no flags, width or precision.
+ */
+static size_t
+format_plain_int(struct Output_Sink *q, uintmax_t val, int base, int is_signed)
+{
+  char digit_buffer[NDIGITS_MAX];
+  size_t o = 0;
+  int ndigits, i;
+
+  if ( is_signed && (intmax_t)val < 0 ) {
+    EMIT('-');
+    val = (uintmax_t)(-(intmax_t)val);
+  }
+
+  if ( val == 0 ) {
+    EMIT('0');
+    return o;
+  }
+
+  ndigits = convert_digits(digit_buffer + NDIGITS_MAX, val, base, lcdigits);
+  for ( i = NDIGITS_MAX - ndigits ; i < NDIGITS_MAX ; i++ )
+    EMIT(digit_buffer[i]);
+
+  return o;
+}
+
 static size_t
 format_int(struct Output_Sink *q, uintmax_t val, enum flags flags,
 	   int base, int width, int prec)
 {
-  char *qq;
+  char *qq, *cp;
   size_t o = 0, oo;
-  static const char lcdigits[] = "0123456789abcdef";
-  static const char ucdigits[] = "0123456789ABCDEF";
   const char *digits;
-  uintmax_t tmpval;
   int minus = 0;
-  int ndigits = 0, nchars;
+  int ndigits, nconv, nchars;
   int tickskip, b4tick;
   char digit_buffer[NDIGITS_MAX]; /* DHH */
+  char conv_buffer[NDIGITS_MAX];
   size_t ndigits_save; /* DHH */
 
   /* Select type of digits */
   digits = (flags & FL_UPPER) ? ucdigits : lcdigits;
 
+  /* A precision overrides the 0 flag, and zero gets no 0x prefix */
+  if ( prec >= 0 )
+    flags &= ~FL_ZERO;
+  if ( base == 16 && val == 0 )
+    flags &= ~FL_HASH;
+
   /* If signed, separate out the minus */
   if ( flags & FL_SIGNED && (intmax_t)val < 0 ) {
     minus = 1;
     val = (uintmax_t)(-(intmax_t)val);
   }
 
-  /* Count the number of digits needed.  This returns zero for 0. */
-  tmpval = val;
-  while ( tmpval ) {
-    tmpval /= base;
-    ndigits++;
-  }
+  /* Convert the number, which also counts the digits.
+     This returns zero for 0. */
+  nconv = convert_digits(conv_buffer + NDIGITS_MAX, val, base, digits);
+  ndigits = nconv;
 
   /* Adjust ndigits for size of output */
 
@@ -134,7 +235,7 @@ format_int(struct Output_Sink *q, uintmax_t val, enum flags flags,
 
   if ( ndigits < prec ) {
     ndigits = prec;		/* Mandatory number padding */
-  } else if ( val == 0 ) {
+  } else if ( val == 0 && prec != 0 ) {
     ndigits = 1;		/* Zero still requires space */
   }
 
@@ -146,7 +247,8 @@ format_int(struct Output_Sink *q, uintmax_t val, enum flags flags,
   }
 
   /* Tick marks aren't digits, but generated by the number converter */
-  ndigits += (ndigits-1)/tickskip;
+  if ( ndigits > 0 )
+    ndigits += (ndigits-1)/tickskip;
 
   /* Now compute the number of nondigits */
   nchars = ndigits;
@@ -190,6 +292,7 @@ format_int(struct Output_Sink *q, uintmax_t val, enum flags flags,
   ASSERT(ndigits <= NDIGITS_MAX); /* DHH */
   ndigits_save = ndigits;
   qq = digit_buffer + ndigits;
+  cp = conv_buffer + NDIGITS_MAX;
   oo = o;
 
   /* Emit digits to temp buffer */
@@ -201,8 +304,12 @@ format_int(struct Output_Sink *q, uintmax_t val, enum flags flags,
       b4tick = tickskip-1;
     }
     qq--; oo--; ndigits--;
-    *qq = digits[val%base];
-    val /= base;
+    if ( nconv > 0 ) {
+      *qq = *--cp;
+      nconv--;
+    } else {
+      *qq = '0';		/* Precision padding */
+    }
   }
 
   /* Copy digits to Output_Sink */
@@ -252,6 +359,41 @@ int Format_Output(struct Output_Sink *q, const char *format, va_list ap)
     switch ( state ) {
     case st_normal:
       if ( ch == '%' ) {
+	/* Fast path for conversions with no flags, width or precision */
+	rank = rank_int;
+	if ( *p == 'l' && (p[1] == 'd' || p[1] == 'i' ||
+			   p[1] == 'u' || p[1] == 'x') ) {
+	  rank = rank_long;
+	  p++;
+	}
+	switch ( *p ) {
+	case 'd':
+	case 'i':
+	  if ( rank == rank_long )
+	    val = (uintmax_t)(intmax_t)va_arg(ap, signed long);
+	  else
+	    val = (uintmax_t)(intmax_t)va_arg(ap, signed int);
+	  o += format_plain_int(q, val, 10, 1);
+	  p++;
+	  continue;
+	case 'u':
+	case 'x':
+	  if ( rank == rank_long )
+	    val = (uintmax_t)va_arg(ap, unsigned long);
+	  else
+	    val = (uintmax_t)va_arg(ap, unsigned int);
+	  o += format_plain_int(q, val, (*p == 'u') ? 10 : 16, 0);
+	  p++;
+	  continue;
+	case 's':
+	  sarg = va_arg(ap, const char *);
+	  sarg = sarg ? sarg : "(null)";
+	  while ( *sarg )
+	    EMIT(*sarg++);
+	  p++;
+	  continue;
+	}
+
 	state = st_flags;
 	flags = 0; rank = rank_int; width = 0; prec = -1;
       } else {
@@ -420,7 +562,7 @@ int Format_Output(struct Output_Sink *q, const char *format, va_list ap)
 
 	is_integer:
 	  sz = format_int(q, val, flags, base, width, prec);
-	  q += sz; o += sz;
+	  o += sz;
 	  break;
 
 	case 'c':		/* Character */
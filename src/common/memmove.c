@@ -39,18 +39,18 @@ memmove(void *d, const void *s, size_t n)
 	char *dst = (char*) d;
 	const char *src = (const char*) s;
 	char *realdst = dst;
-	if (n <= 0)
+	if (n == 0)
 		return dst;
 	if (src >= dst+n || dst >= src+n)
 		return memcpy(dst, src, n);
 	if (src > dst) {
-		while (--n >= 0)
+		while (n-- > 0)
 			*dst++ = *src++;
 	}
 	else if (src < dst) {
 		src += n;
 		dst += n;
-		while (--n >= 0)
+		while (n-- > 0)
 			*--dst = *--src;
 	}
 	return realdst;
@@ -46,7 +46,7 @@ void* memcpy(void *dst, const void* src, size_t n)
 
 int memcmp(const void *s1_, const void *s2_, size_t n)
 {
-    const signed char *s1 = s1_, *s2 = s2_;
+    const unsigned char *s1 = s1_, *s2 = s2_;
 
     while (n > 0) {
 	int cmp = *s1 - *s2;
@@ -54,6 +54,7 @@ int memcmp(const void *s1_, const void *s2_, size_t n)
 	    return cmp;
 	++s1;
 	++s2;
+	--n;
     }
 
     return 0;
@@ -231,7 +232,7 @@ static void String_Finish(struct Output_Sink *o_)
 
     if (o->n < o->size)
 	*(o->s) = '\0';
-    else
+    else if (o->size > 0)
 	/*
 	 * Output was truncated; write terminator at end of buffer
 	 * (we will have advanced one character too far)
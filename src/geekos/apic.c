@@ -0,0 +1,336 @@
+/*
+ * Local and I/O APICs
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * Information sources:
+ * - Intel 64 and IA-32 Architectures Software Developer's Manual,
+ *   Volume 3A, chapter 10 (Advanced Programmable Interrupt Controller).
+ * - Intel 82093AA I/O Advanced Programmable Interrupt Controller
+ *   datasheet.
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/screen.h>
+#include <geekos/int.h>
+#include <geekos/idt.h>
+#include <geekos/cpu.h>
+#include <geekos/timer.h>
+#include <geekos/kthread.h>
+#include <geekos/smp.h>
+#include <geekos/apic.h>
+
+/* ----------------------------------------------------------------------
+ * Private data and functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Local APIC registers, as offsets from its base address.
+ */
+#define LAPIC_ID		0x020
+#define LAPIC_VERSION		0x030
+#define LAPIC_TPR		0x080
+#define LAPIC_EOI		0x0b0
+#define LAPIC_SVR		0x0f0
+#define LAPIC_ICR_LOW		0x300
+#define LAPIC_ICR_HIGH		0x310
+#define LAPIC_LVT_TIMER		0x320
+#define LAPIC_LVT_LINT0		0x350
+#define LAPIC_LVT_LINT1		0x360
+#define LAPIC_LVT_ERROR		0x370
+#define LAPIC_TIMER_INITIAL	0x380
+#define LAPIC_TIMER_CURRENT	0x390
+#define LAPIC_TIMER_DIVIDE	0x3e0
+
+#define LAPIC_SVR_ENABLE	(1 << 8)
+#define LVT_MASKED		(1 << 16)
+#define LVT_TIMER_PERIODIC	(1 << 17)
+#define ICR_SEND_PENDING	(1 << 12)
+#define TIMER_DIVIDE_BY_16	0x3
+
+/*
+ * Number of times to poll for an IPI to be sent before giving up.
+ */
+#define IPI_SEND_POLLS 100000
+
+/*
+ * I/O APIC registers.  They are accessed indirectly: write the
+ * register number to IOREGSEL, then read or write IOWIN.
+ */
+#define IOAPIC_REGSEL		0x00
+#define IOAPIC_WINDOW		0x10
+#define IOAPIC_VERSION		0x01
+#define IOAPIC_REDIRECT(pin)	(0x10 + 2 * (pin))
+
+#define REDIRECT_ACTIVE_LOW	(1 << 13)
+#define REDIRECT_LEVEL		(1 << 15)
+#define REDIRECT_MASKED		(1 << 16)
+
+/*
+ * Number of PIT ticks the local APIC timer is calibrated over.
+ */
+#define CALIBRATE_TICKS 2
+
+/*
+ * Local APIC timer counts and TSC cycles per PIT tick and
+ * microsecond, from Calibrate_Local_APIC_Timer().
+ */
+static ulong_t s_timerCountPerTick;
+static ulong_t s_tscPerUs;
+
+/*
+ * Number of input pins of the I/O APIC.
+ */
+static int s_numIOAPICPins;
+
+static __inline__ ulong_t Read_Local_APIC(ulong_t reg)
+{
+    return *((volatile ulong_t*) (Get_Local_APIC_Address() + reg));
+}
+
+static __inline__ void Write_Local_APIC(ulong_t reg, ulong_t value)
+{
+    *((volatile ulong_t*) (Get_Local_APIC_Address() + reg)) = value;
+}
+
+static ulong_t Read_IO_APIC(ulong_t reg)
+{
+    ulong_t base = Get_IO_APIC_Address();
+
+    *((volatile ulong_t*) (base + IOAPIC_REGSEL)) = reg;
+    return *((volatile ulong_t*) (base + IOAPIC_WINDOW));
+}
+
+static void Write_IO_APIC(ulong_t reg, ulong_t value)
+{
+    ulong_t base = Get_IO_APIC_Address();
+
+    *((volatile ulong_t*) (base + IOAPIC_REGSEL)) = reg;
+    *((volatile ulong_t*) (base + IOAPIC_WINDOW)) = value;
+}
+
+/*
+ * Spurious interrupts must not be acknowledged.
+ */
+static void Spurious_Interrupt_Handler(struct Interrupt_State* state)
+{
+}
+
+/*
+ * The local APIC timer drives preemption on the
+ * application processors.
+ */
+static void Local_Timer_Interrupt_Handler(struct Interrupt_State* state)
+{
+    Charge_Timer_Tick(state);
+    Local_APIC_EOI();
+}
+
+/*
+ * Another processor put a thread on our run queue that should
+ * run now; the interrupt return code will choose it.
+ */
+static void Reschedule_Interrupt_Handler(struct Interrupt_State* state)
+{
+    g_needReschedule = true;
+    Local_APIC_EOI();
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Enable the local APIC of the processor we're running on.
+ * On the boot processor, LINT0 is left the way the BIOS set it up,
+ * so the PICs keep delivering interrupts until Init_IO_APIC()
+ * takes over.  The application processors don't take external
+ * interrupts through LINT0 or LINT1 at all.
+ */
+void Init_Local_APIC(bool bootProcessor)
+{
+    KASSERT(Get_Local_APIC_Address() != 0);
+
+    if (bootProcessor) {
+	Install_Interrupt_Handler(SPURIOUS_VECTOR, &Spurious_Interrupt_Handler);
+	Install_Interrupt_Handler(LOCAL_TIMER_VECTOR, &Local_Timer_Interrupt_Handler);
+	Install_Interrupt_Handler(RESCHEDULE_VECTOR, &Reschedule_Interrupt_Handler);
+    } else {
+	Write_Local_APIC(LAPIC_LVT_LINT0, LVT_MASKED);
+	Write_Local_APIC(LAPIC_LVT_LINT1, LVT_MASKED);
+    }
+
+    Write_Local_APIC(LAPIC_LVT_TIMER, LVT_MASKED | LOCAL_TIMER_VECTOR);
+    Write_Local_APIC(LAPIC_LVT_ERROR, LVT_MASKED);
+    Write_Local_APIC(LAPIC_TPR, 0);
+    Write_Local_APIC(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+}
+
+/*
+ * Get the APIC id of the processor we're running on.
+ */
+uchar_t Get_Local_APIC_ID(void)
+{
+    return Read_Local_APIC(LAPIC_ID) >> 24;
+}
+
+/*
+ * Get the version of the local APIC of the processor we're running on.
+ * 0x1x is an integrated APIC, 0x0x an external 82489DX.
+ */
+uchar_t Get_Local_APIC_Version(void)
+{
+    return Read_Local_APIC(LAPIC_VERSION) & 0xff;
+}
+
+/*
+ * Acknowledge an interrupt delivered by the local APIC.
+ */
+void Local_APIC_EOI(void)
+{
+    Write_Local_APIC(LAPIC_EOI, 0);
+}
+
+/*
+ * Send an interprocessor interrupt to the processor with given
+ * APIC id.  The command is one of the IPI_ values in apic.h.
+ * Returns false if the local APIC didn't manage to send it.
+ */
+bool Send_IPI(uchar_t apicId, ulong_t command)
+{
+    bool iflag = Begin_Int_Atomic();
+    int polls;
+
+    /* Writing the low word sends the IPI */
+    Write_Local_APIC(LAPIC_ICR_HIGH, ((ulong_t) apicId) << 24);
+    Write_Local_APIC(LAPIC_ICR_LOW, command);
+
+    for (polls = 0; polls < IPI_SEND_POLLS; ++polls) {
+	if ((Read_Local_APIC(LAPIC_ICR_LOW) & ICR_SEND_PENDING) == 0)
+	    break;
+	__asm__ __volatile__ ("pause");
+    }
+
+    End_Int_Atomic(iflag);
+    return polls < IPI_SEND_POLLS;
+}
+
+/*
+ * Measure the local APIC timer and time stamp counter against the PIT.
+ * Called on the boot processor, with interrupts enabled and the timer
+ * running.  The local APIC timers of all processors run at the bus
+ * clock, so one calibration does for all of them.
+ */
+void Calibrate_Local_APIC_Timer(void)
+{
+    ulong_t start, count, tsc;
+
+    KASSERT(Interrupts_Enabled());
+
+    Write_Local_APIC(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_BY_16);
+    Write_Local_APIC(LAPIC_LVT_TIMER, LVT_MASKED | LOCAL_TIMER_VECTOR);
+
+    /* Start counting right after a tick */
+    start = g_numTicks;
+    while (g_numTicks == start)
+	;
+
+    Write_Local_APIC(LAPIC_TIMER_INITIAL, 0xffffffff);
+    tsc = Read_TSC();
+    start = g_numTicks;
+    while (g_numTicks - start < CALIBRATE_TICKS)
+	;
+    count = 0xffffffff - Read_Local_APIC(LAPIC_TIMER_CURRENT);
+    tsc = Read_TSC() - tsc;
+    Write_Local_APIC(LAPIC_TIMER_INITIAL, 0);
+
+    s_timerCountPerTick = count / CALIBRATE_TICKS;
+    s_tscPerUs = tsc / (CALIBRATE_TICKS * US_PER_PIT_TICK) + 1;
+
+    Print("Local APIC timer: %lu counts, %lu cycles per tick\n",
+	s_timerCountPerTick, tsc / CALIBRATE_TICKS);
+}
+
+/*
+ * Start the local APIC timer of the processor we're running on,
+ * interrupting at the same rate as the PIT.
+ */
+void Start_Local_APIC_Timer(void)
+{
+    KASSERT(s_timerCountPerTick != 0);
+
+    Write_Local_APIC(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_BY_16);
+    Write_Local_APIC(LAPIC_LVT_TIMER, LVT_TIMER_PERIODIC | LOCAL_TIMER_VECTOR);
+    Write_Local_APIC(LAPIC_TIMER_INITIAL, s_timerCountPerTick);
+}
+
+/*
+ * Busy wait for given number of microseconds.
+ * Only usable after Calibrate_Local_APIC_Timer().
+ */
+void APIC_Delay(ulong_t us)
+{
+    ulong_t start = Read_TSC();
+    ulong_t cycles = us * s_tscPerUs;
+
+    KASSERT(s_tscPerUs != 0);
+
+    while (Read_TSC() - start < cycles)
+	__asm__ __volatile__ ("pause");
+}
+
+/*
+ * Route the ISA IRQs through the I/O APIC to the boot processor,
+ * masked according to given IRQ mask, and stop taking interrupts
+ * from the PICs through LINT0.  Called on the boot processor,
+ * with interrupts disabled.
+ */
+void Init_IO_APIC(ushort_t irqMask)
+{
+    int pin;
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(Get_IO_APIC_Address() != 0);
+
+    s_numIOAPICPins = ((Read_IO_APIC(IOAPIC_VERSION) >> 16) & 0xff) + 1;
+
+    for (pin = 0; pin < s_numIOAPICPins; ++pin) {
+	Write_IO_APIC(IOAPIC_REDIRECT(pin), REDIRECT_MASKED);
+	Write_IO_APIC(IOAPIC_REDIRECT(pin) + 1, 0);
+    }
+    Set_IO_APIC_Mask(irqMask);
+
+    Write_Local_APIC(LAPIC_LVT_LINT0, LVT_MASKED);
+}
+
+/*
+ * Mask and unmask the I/O APIC pins the ISA IRQs are routed to.
+ * Each bit position in the mask represents one of the 16 IRQ lines.
+ */
+void Set_IO_APIC_Mask(ushort_t irqMask)
+{
+    ulong_t dest = ((ulong_t) Get_CPU_By_Index(0)->apicId) << 24;
+    int irq;
+
+    for (irq = 0; irq < 16; ++irq) {
+	const struct ISA_IRQ_Route* route = Get_ISA_IRQ_Route(irq);
+	ulong_t entry;
+
+	if (route == 0 || route->pin >= s_numIOAPICPins)
+	    continue;
+
+	entry = FIRST_EXTERNAL_INT + irq;
+	if (route->activeLow)
+	    entry |= REDIRECT_ACTIVE_LOW;
+	if (route->levelTriggered)
+	    entry |= REDIRECT_LEVEL;
+	if (irqMask & (1 << irq))
+	    entry |= REDIRECT_MASKED;
+
+	Write_IO_APIC(IOAPIC_REDIRECT(route->pin) + 1, dest);
+	Write_IO_APIC(IOAPIC_REDIRECT(route->pin), entry);
+    }
+}
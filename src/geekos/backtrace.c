@@ -0,0 +1,115 @@
+/*
+ * Stack unwinding using the frame pointer chain
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/defs.h>
+#include <geekos/kthread.h>
+#include <geekos/screen.h>
+#include <geekos/backtrace.h>
+
+/*
+ * The kernel is compiled with -fno-omit-frame-pointer, so every
+ * function starts by pushing %ebp and pointing %ebp at the saved
+ * copy.  The saved frame pointers form a chain up the stack, and
+ * the word above each one is the return address into the caller:
+ *
+ *   ebp + 4:  return address
+ *   ebp:      caller's ebp
+ *
+ * Threads start with a zero frame pointer (see Setup_Kernel_Thread()),
+ * which ends the chain.  Addresses are printed in hex; use
+ * scripts/eipToFunction to turn them into function names.
+ */
+
+/* ----------------------------------------------------------------------
+ * Private functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Find the bounds of the stack we're running on.  Interrupts
+ * are handled on the stack of the interrupted thread, and before
+ * the scheduler is initialized we run on the main thread's stack.
+ */
+static void Get_Stack_Bounds(ulong_t* low, ulong_t* high)
+{
+    if (g_currentThread != 0 && g_currentThread->stackPage != 0)
+	*low = (ulong_t) g_currentThread->stackPage;
+    else
+	*low = KERN_STACK;
+    *high = *low + PAGE_SIZE;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Walk the frame pointer chain starting at given frame, storing
+ * up to maxFrames return addresses (innermost first).
+ * Each frame must be aligned, lie within the current thread's
+ * stack, and be above the previous one, so a corrupt chain can't
+ * send us off into the weeds.  Returns the number of addresses stored.
+ */
+int Get_Backtrace(ulong_t ebp, ulong_t* frames, int maxFrames)
+{
+    ulong_t low, high;
+    int count = 0;
+
+    Get_Stack_Bounds(&low, &high);
+
+    while (count < maxFrames) {
+	ulong_t* frame = (ulong_t*) ebp;
+	ulong_t next;
+
+	if (ebp < low || ebp > high - 2 * sizeof(ulong_t) || (ebp & 3) != 0)
+	    break;
+	if (frame[1] == 0)
+	    break;
+
+	frames[count++] = frame[1];
+
+	next = frame[0];
+	if (next <= ebp)
+	    break;
+	ebp = next;
+    }
+
+    return count;
+}
+
+/*
+ * Get the return addresses of the calling function's callers.
+ * The first one is the return address into whoever
+ * called Get_Current_Backtrace().
+ */
+int Get_Current_Backtrace(ulong_t* frames, int maxFrames)
+{
+    return Get_Backtrace((ulong_t) __builtin_frame_address(0), frames, maxFrames);
+}
+
+/*
+ * Print a backtrace starting at given frame, on one line.
+ */
+void Print_Backtrace(ulong_t ebp)
+{
+    ulong_t frames[MAX_BACKTRACE_DEPTH];
+    int count, i;
+
+    count = Get_Backtrace(ebp, frames, MAX_BACKTRACE_DEPTH);
+
+    Print("Backtrace:");
+    for (i = 0; i < count; ++i)
+	Print(" %lx", frames[i]);
+    Print("\n");
+}
+
+/*
+ * Print a backtrace of the calling function.
+ */
+void Print_Current_Backtrace(void)
+{
+    Print_Backtrace((ulong_t) __builtin_frame_address(0));
+}
@@ -0,0 +1,211 @@
+/*
+ * Kernel microbenchmark harness
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/screen.h>
+#include <geekos/serial.h>
+#include <geekos/io.h>
+#include <geekos/int.h>
+#include <geekos/cpu.h>
+#include <geekos/kthread.h>
+#include <geekos/perfctr.h>
+#include <geekos/smp.h>
+#include <geekos/bench.h>
+
+/* ----------------------------------------------------------------------
+ * Private data and functions
+ * ---------------------------------------------------------------------- */
+
+static struct Benchmark_List s_benchmarkList;
+
+/*
+ * Cycles per operation for each timed run.
+ */
+static ulong_t s_samples[BENCH_TIMED_RUNS];
+
+static void Sort_Samples(ulong_t* samples, int count)
+{
+    int i, j;
+
+    for (i = 1; i < count; ++i) {
+	ulong_t value = samples[i];
+	for (j = i; j > 0 && samples[j - 1] > value; --j)
+	    samples[j] = samples[j - 1];
+	samples[j] = value;
+    }
+}
+
+/*
+ * Run a benchmark once, and return the cycles per operation.
+ * The TSC is read as 32 bits, so a run must take well
+ * under 2^32 cycles.
+ */
+static ulong_t Time_Run(struct Benchmark* bench)
+{
+    ulong_t start, elapsed;
+
+    start = Read_TSC();
+    bench->run(bench->iterations);
+    elapsed = Read_TSC() - start;
+
+    return elapsed / bench->iterations;
+}
+
+/*
+ * Total cycles all processors have spent waiting for the kernel lock.
+ */
+static unsigned long long Kernel_Lock_Wait_Cycles(void)
+{
+    unsigned long long total = 0;
+    bool iflag;
+    int i;
+
+    iflag = Begin_Int_Atomic();
+    for (i = 0; i < Get_Num_CPUs(); ++i)
+	total += Get_CPU_By_Index(i)->kernelLockWaitCycles;
+    End_Int_Atomic(iflag);
+
+    return total;
+}
+
+/*
+ * Run a benchmark and report its results, both on the screen
+ * and on the serial port.  The serial line is
+ *
+ *   BENCH <name> <iterations> <min> <median> <p99> switches/kop=<n> kwait=<n>
+ *
+ * with the times in cycles per operation, followed by the context
+ * switches per thousand operations over all timed runs, and the
+ * thousandths of the online processors' time that they spent waiting
+ * for the kernel lock during the timed runs.  If there are
+ * performance counters, the instructions per cycle and
+ * misses per thousand operations of the benchmark thread
+ * over all timed runs are added to the end.
+ */
+static void Run_Benchmark(struct Benchmark* bench)
+{
+    struct Perf_Counts before, after;
+    unsigned long long ops = (unsigned long long) bench->iterations * BENCH_TIMED_RUNS;
+    unsigned long long start, elapsed, lockWait;
+    ulong_t switches, kwait;
+    ulong_t min, median, p99;
+    int i;
+
+    if (bench->setup != 0)
+	bench->setup();
+
+    for (i = 0; i < BENCH_WARMUP_RUNS; ++i)
+	bench->run(bench->iterations);
+
+    Get_Thread_Perf_Counts(g_currentThread, &before);
+    switches = g_numContextSwitches;
+    lockWait = Kernel_Lock_Wait_Cycles();
+    start = Read_TSC_64();
+    for (i = 0; i < BENCH_TIMED_RUNS; ++i)
+	s_samples[i] = Time_Run(bench);
+    elapsed = Read_TSC_64() - start;
+    lockWait = Kernel_Lock_Wait_Cycles() - lockWait;
+    switches = g_numContextSwitches - switches;
+    Get_Thread_Perf_Counts(g_currentThread, &after);
+
+    if (bench->teardown != 0)
+	bench->teardown();
+
+    Sort_Samples(s_samples, BENCH_TIMED_RUNS);
+    min = s_samples[0];
+    median = s_samples[BENCH_TIMED_RUNS / 2];
+    p99 = s_samples[(BENCH_TIMED_RUNS * 99 + 99) / 100 - 1];
+
+    switches = Perf_Ratio(switches, ops, 1000);
+    kwait = Perf_Ratio(lockWait, elapsed * Get_Num_Online_CPUs(), 1000);
+    Print("%-16s %6d %8lu %8lu %8lu %7lu %5lu",
+	bench->name, bench->iterations, min, median, p99, switches, kwait);
+    Serial_Print("BENCH %s %d %lu %lu %lu switches/kop=%lu kwait=%lu",
+	bench->name, bench->iterations, min, median, p99, switches, kwait);
+
+    if (Perf_Counters_Present()) {
+	unsigned long long delta[NUM_PERF_EVENTS];
+	ulong_t ipc;
+
+	for (i = 0; i < NUM_PERF_EVENTS; ++i)
+	    delta[i] = after.count[i] - before.count[i];
+	ipc = Perf_Ratio(delta[PERF_INSTRUCTIONS], delta[PERF_CYCLES], 100);
+
+	Print(" %3lu.%02lu", ipc / 100, ipc % 100);
+	Serial_Print(" ipc=%lu.%02lu", ipc / 100, ipc % 100);
+	for (i = PERF_LLC_MISSES; i < NUM_PERF_EVENTS; ++i) {
+	    ulong_t perKop = Perf_Ratio(delta[i], ops, 1000);
+	    Print(" %6lu", perKop);
+	    Serial_Print(" %s/kop=%lu", Get_Perf_Event_Name(i), perKop);
+	}
+    }
+
+    Print("\n");
+    Serial_Print("\n");
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Add a benchmark to the suite run by Run_Benchmarks().
+ */
+void Register_Benchmark(struct Benchmark* bench)
+{
+    KASSERT(bench->run != 0);
+    KASSERT(bench->iterations > 0);
+
+    Add_To_Back_Of_Benchmark_List(&s_benchmarkList, bench);
+}
+
+/*
+ * Run all registered benchmarks, in the order they were registered.
+ * Serial output is bracketed by BENCH-BEGIN and BENCH-END lines.
+ * The screen table isn't mirrored to the serial port, so that
+ * every BENCH record there is a line of its own.
+ * Returns zero (the exit code for the benchmark build).
+ */
+int Run_Benchmarks(void)
+{
+    struct Benchmark* bench;
+    bool mirror = g_serialMirror;
+    int count = 0;
+
+    for (bench = Get_Front_Of_Benchmark_List(&s_benchmarkList); bench != 0;
+	 bench = Get_Next_In_Benchmark_List(bench))
+	++count;
+
+    g_serialMirror = false;
+    Serial_Print("BENCH-BEGIN %d\n", count);
+    Print("%-16s %6s %8s %8s %8s %7s %5s", "benchmark", "iters", "min", "median", "p99", "cs/k", "kw/k");
+    if (Perf_Counters_Present())
+	Print(" %6s %6s %6s", "IPC", "LLC/k", "br/k");
+    Print("\n");
+
+    for (bench = Get_Front_Of_Benchmark_List(&s_benchmarkList); bench != 0;
+	 bench = Get_Next_In_Benchmark_List(bench))
+	Run_Benchmark(bench);
+
+    Serial_Print("BENCH-END\n");
+    g_serialMirror = mirror;
+    return 0;
+}
+
+/*
+ * Leave the emulator, if it has an isa-debug-exit device
+ * (see BENCH_EXIT_PORT).  Otherwise, just stop.
+ */
+void Exit_Emulator(int code)
+{
+    Serial_Flush();
+    Out_Byte(BENCH_EXIT_PORT, code);
+
+    Print("Exit code %d; halting\n", code);
+    Disable_Interrupts();
+    STOP();
+}
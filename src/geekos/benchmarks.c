@@ -0,0 +1,560 @@
+/*
+ * Kernel microbenchmarks
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/screen.h>
+#include <geekos/serial.h>
+#include <geekos/string.h>
+#include <geekos/kthread.h>
+#include <geekos/synch.h>
+#include <geekos/malloc.h>
+#include <geekos/mem.h>
+#include <geekos/crc32.h>
+#include <geekos/timer.h>
+#include <geekos/smp.h>
+#include <geekos/bench.h>
+
+/* ----------------------------------------------------------------------
+ * Private data and functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Set to make helper threads exit.
+ */
+static volatile bool s_stop;
+
+/*
+ * Start a helper thread at given priority.
+ */
+static struct Kernel_Thread* Start_Helper(Thread_Start_Func func, ulong_t arg, int priority)
+{
+    struct Kernel_Thread* kthread = Start_Kernel_Thread(func, arg, priority, false);
+    KASSERT(kthread != 0);
+    return kthread;
+}
+
+/*
+ * Context switch: a round trip through a partner thread,
+ * using a pair of semaphores.  Each operation is two switches.
+ */
+static struct Semaphore s_ping, s_pong;
+static struct Kernel_Thread* s_partner;
+
+static void Ping_Pong_Partner(ulong_t arg)
+{
+    for (;;) {
+	Sem_P(&s_ping);
+	if (s_stop)
+	    break;
+	Sem_V(&s_pong);
+    }
+}
+
+static void Setup_Context_Switch(void)
+{
+    Sem_Init(&s_ping, 0);
+    Sem_Init(&s_pong, 0);
+    s_stop = false;
+    s_partner = Start_Helper(Ping_Pong_Partner, 0, PRIORITY_NORMAL);
+}
+
+static void Bench_Context_Switch(int iterations)
+{
+    int i;
+
+    for (i = 0; i < iterations; ++i) {
+	Sem_V(&s_ping);
+	Sem_P(&s_pong);
+    }
+}
+
+static void Teardown_Context_Switch(void)
+{
+    s_stop = true;
+    Sem_V(&s_ping);
+    Join(s_partner);
+}
+
+/*
+ * Uncontended mutex lock and unlock.
+ */
+static struct Mutex s_mutex;
+static struct Condition s_cond;
+
+static void Bench_Mutex_Lock(int iterations)
+{
+    int i;
+
+    for (i = 0; i < iterations; ++i) {
+	Mutex_Lock(&s_mutex);
+	Mutex_Unlock(&s_mutex);
+    }
+}
+
+/*
+ * Mutex ping-pong: two threads take turns holding a mutex,
+ * handing it over with a condition variable.
+ */
+static volatile int s_turn;
+
+static void Mutex_Partner(ulong_t arg)
+{
+    Mutex_Lock(&s_mutex);
+    for (;;) {
+	while (s_turn != 1 && !s_stop)
+	    Cond_Wait(&s_cond, &s_mutex);
+	if (s_stop)
+	    break;
+	s_turn = 0;
+	Cond_Signal(&s_cond);
+    }
+    Mutex_Unlock(&s_mutex);
+}
+
+static void Setup_Mutex_Ping_Pong(void)
+{
+    Cond_Init(&s_cond);
+    s_turn = 0;
+    s_stop = false;
+    s_partner = Start_Helper(Mutex_Partner, 0, PRIORITY_NORMAL);
+}
+
+static void Bench_Mutex_Ping_Pong(int iterations)
+{
+    int i;
+
+    Mutex_Lock(&s_mutex);
+    for (i = 0; i < iterations; ++i) {
+	s_turn = 1;
+	Cond_Signal(&s_cond);
+	while (s_turn != 0)
+	    Cond_Wait(&s_cond, &s_mutex);
+    }
+    Mutex_Unlock(&s_mutex);
+}
+
+static void Teardown_Mutex_Ping_Pong(void)
+{
+    Mutex_Lock(&s_mutex);
+    s_stop = true;
+    Cond_Signal(&s_cond);
+    Mutex_Unlock(&s_mutex);
+    Join(s_partner);
+}
+
+/*
+ * Readers: several threads enter a read-side critical section that
+ * yields the CPU, so they overlap.  Run once protected by a mutex,
+ * which serializes them, and once by a reader-writer lock.
+ */
+#define NUM_READERS 4
+
+static struct RWLock s_rwlock;
+static bool s_useRWLock;
+static struct Semaphore s_readersStart, s_readersDone;
+static volatile int s_readsPerThread;
+static struct Kernel_Thread* s_readers[NUM_READERS];
+
+static void Reader(ulong_t arg)
+{
+    int i;
+
+    for (;;) {
+	Sem_P(&s_readersStart);
+	if (s_stop)
+	    break;
+	for (i = 0; i < s_readsPerThread; ++i) {
+	    if (s_useRWLock) {
+		Read_Lock(&s_rwlock);
+		Yield();
+		Read_Unlock(&s_rwlock);
+	    } else {
+		Mutex_Lock(&s_mutex);
+		Yield();
+		Mutex_Unlock(&s_mutex);
+	    }
+	}
+	Sem_V(&s_readersDone);
+    }
+}
+
+static void Start_Readers(void)
+{
+    int i;
+
+    RWLock_Init(&s_rwlock);
+    Sem_Init(&s_readersStart, 0);
+    Sem_Init(&s_readersDone, 0);
+    s_stop = false;
+    for (i = 0; i < NUM_READERS; ++i)
+	s_readers[i] = Start_Helper(Reader, 0, PRIORITY_NORMAL);
+}
+
+static void Setup_Mutex_Readers(void)
+{
+    s_useRWLock = false;
+    Start_Readers();
+}
+
+static void Setup_RWLock_Readers(void)
+{
+    s_useRWLock = true;
+    Start_Readers();
+}
+
+static void Bench_Readers(int iterations)
+{
+    int i;
+
+    s_readsPerThread = iterations / NUM_READERS;
+    for (i = 0; i < NUM_READERS; ++i)
+	Sem_V(&s_readersStart);
+    for (i = 0; i < NUM_READERS; ++i)
+	Sem_P(&s_readersDone);
+}
+
+static void Stop_Readers(void)
+{
+    int i;
+
+    s_stop = true;
+    for (i = 0; i < NUM_READERS; ++i)
+	Sem_V(&s_readersStart);
+    for (i = 0; i < NUM_READERS; ++i)
+	Join(s_readers[i]);
+}
+
+/*
+ * Broadcast: wake several threads waiting on a condition, and
+ * wait until all of them have reacquired the mutex.  Run with and
+ * without wait morphing (see Cond_Broadcast()); compare the
+ * context switches per operation.
+ */
+#define NUM_WAITERS 8
+
+static struct Condition s_allArrived;
+static volatile ulong_t s_generation;
+static volatile int s_arrived;
+static struct Kernel_Thread* s_waiters[NUM_WAITERS];
+
+static void Broadcast_Waiter(ulong_t arg)
+{
+    ulong_t seen = 0;
+
+    Mutex_Lock(&s_mutex);
+    for (;;) {
+	while (s_generation == seen && !s_stop)
+	    Cond_Wait(&s_cond, &s_mutex);
+	if (s_stop)
+	    break;
+	seen = s_generation;
+	if (++s_arrived == NUM_WAITERS)
+	    Cond_Signal(&s_allArrived);
+    }
+    Mutex_Unlock(&s_mutex);
+}
+
+static void Start_Waiters(void)
+{
+    int i;
+
+    Cond_Init(&s_cond);
+    Cond_Init(&s_allArrived);
+    s_generation = 0;
+    s_stop = false;
+    for (i = 0; i < NUM_WAITERS; ++i)
+	s_waiters[i] = Start_Helper(Broadcast_Waiter, 0, PRIORITY_NORMAL);
+}
+
+static void Setup_Broadcast_Morph(void)
+{
+    g_waitMorphing = true;
+    Start_Waiters();
+}
+
+static void Setup_Broadcast_Wake(void)
+{
+    g_waitMorphing = false;
+    Start_Waiters();
+}
+
+static void Bench_Broadcast(int iterations)
+{
+    int i;
+
+    Mutex_Lock(&s_mutex);
+    for (i = 0; i < iterations; ++i) {
+	s_arrived = 0;
+	++s_generation;
+	Cond_Broadcast(&s_cond);
+	while (s_arrived < NUM_WAITERS)
+	    Cond_Wait(&s_allArrived, &s_mutex);
+    }
+    Mutex_Unlock(&s_mutex);
+}
+
+static void Stop_Waiters(void)
+{
+    int i;
+
+    Mutex_Lock(&s_mutex);
+    s_stop = true;
+    Cond_Broadcast(&s_cond);
+    Mutex_Unlock(&s_mutex);
+    for (i = 0; i < NUM_WAITERS; ++i)
+	Join(s_waiters[i]);
+
+    g_waitMorphing = true;
+}
+
+/*
+ * CPU share: a unit of busy work, alone and competing with a
+ * busy thread one priority level lower.  Under SCHED_PRIORITY the
+ * competitor never runs, so both cost the same; under SCHED_FAIR
+ * it gets its weighted share of the CPU, and each unit takes
+ * correspondingly longer.  The quantum is shortened to a single
+ * tick so a run spans several scheduling decisions.
+ */
+#define SPIN_UNIT 10000
+
+static struct Kernel_Thread* s_competitor;
+static int s_savedQuantum;
+
+static void Spin_Unit(void)
+{
+    volatile int count;
+
+    for (count = 0; count < SPIN_UNIT; ++count)
+	;
+}
+
+static void Competitor(ulong_t arg)
+{
+    while (!s_stop)
+	Spin_Unit();
+}
+
+static void Setup_Spin(void)
+{
+    s_savedQuantum = g_Quantum;
+    g_Quantum = 1;
+}
+
+static void Teardown_Spin(void)
+{
+    g_Quantum = s_savedQuantum;
+}
+
+static void Setup_CPU_Share(void)
+{
+    Setup_Spin();
+    s_stop = false;
+    s_competitor = Start_Helper(Competitor, 0, PRIORITY_NORMAL - 1);
+}
+
+static void Bench_Spin(int iterations)
+{
+    int i;
+
+    for (i = 0; i < iterations; ++i)
+	Spin_Unit();
+}
+
+static void Teardown_CPU_Share(void)
+{
+    s_stop = true;
+    Join(s_competitor);
+    Teardown_Spin();
+}
+
+/*
+ * Scaling: the spin units of a run are split evenly between
+ * worker threads, each restricted to its own processor.  Run with
+ * one worker and with one per online processor; the ratio of the
+ * costs per unit is the speedup from running on all of them.
+ */
+static struct Semaphore s_workerStart[MAX_CPUS], s_workersDone;
+static struct Kernel_Thread* s_workers[MAX_CPUS];
+static int s_numWorkers;
+static volatile int s_unitsPerWorker;
+
+static void Worker(ulong_t arg)
+{
+    int i;
+
+    for (;;) {
+	Sem_P(&s_workerStart[arg]);
+	if (s_stop)
+	    break;
+	for (i = 0; i < s_unitsPerWorker; ++i)
+	    Spin_Unit();
+	Sem_V(&s_workersDone);
+    }
+}
+
+static void Start_Workers(int numWorkers)
+{
+    int cpu;
+
+    Sem_Init(&s_workersDone, 0);
+    s_stop = false;
+    s_numWorkers = 0;
+    for (cpu = 0; cpu < Get_Num_CPUs() && s_numWorkers < numWorkers; ++cpu) {
+	struct Kernel_Thread* worker;
+
+	if (!Get_CPU_By_Index(cpu)->online)
+	    continue;
+	Sem_Init(&s_workerStart[s_numWorkers], 0);
+	worker = Start_Helper(Worker, s_numWorkers, PRIORITY_NORMAL);
+	Set_Affinity(worker, 1UL << cpu);
+	s_workers[s_numWorkers++] = worker;
+    }
+}
+
+static void Setup_Scale_One(void)
+{
+    Start_Workers(1);
+}
+
+static void Setup_Scale_All(void)
+{
+    Start_Workers(Get_Num_Online_CPUs());
+}
+
+static void Bench_Scale(int iterations)
+{
+    int i;
+
+    s_unitsPerWorker = iterations / s_numWorkers;
+    for (i = 0; i < s_numWorkers; ++i)
+	Sem_V(&s_workerStart[i]);
+    for (i = 0; i < s_numWorkers; ++i)
+	Sem_P(&s_workersDone);
+}
+
+static void Stop_Workers(void)
+{
+    int i;
+
+    s_stop = true;
+    for (i = 0; i < s_numWorkers; ++i)
+	Sem_V(&s_workerStart[i]);
+    for (i = 0; i < s_numWorkers; ++i)
+	Join(s_workers[i]);
+}
+
+/*
+ * Memory allocation.
+ */
+static void Bench_Malloc_Free(int iterations)
+{
+    int i;
+
+    for (i = 0; i < iterations; ++i) {
+	void* buf = Malloc(64);
+	KASSERT(buf != 0);
+	Free(buf);
+    }
+}
+
+static void Bench_Alloc_Page(int iterations)
+{
+    int i;
+
+    for (i = 0; i < iterations; ++i) {
+	void* page = Alloc_Page();
+	KASSERT(page != 0);
+	Free_Page(page);
+    }
+}
+
+/*
+ * Copying and checksumming a page.
+ */
+static char s_srcBuf[PAGE_SIZE], s_dstBuf[PAGE_SIZE];
+static volatile ulong_t s_checksum;
+
+static void Bench_Memcpy(int iterations)
+{
+    int i;
+
+    for (i = 0; i < iterations; ++i)
+	memcpy(s_dstBuf, s_srcBuf, sizeof(s_dstBuf));
+}
+
+static void Bench_CRC32(int iterations)
+{
+    int i;
+
+    for (i = 0; i < iterations; ++i)
+	s_checksum = crc32(0, s_srcBuf, sizeof(s_srcBuf));
+}
+
+/*
+ * Formatted output to the screen.  Mirroring to the serial
+ * port is turned off, so only the console is measured and
+ * the benchmark output isn't drowned.
+ */
+static bool s_savedMirror;
+
+static void Setup_Print(void)
+{
+    s_savedMirror = g_serialMirror;
+    g_serialMirror = false;
+}
+
+static void Bench_Print(int iterations)
+{
+    int i;
+
+    for (i = 0; i < iterations; ++i)
+	Print("Print benchmark: %d %x %s\n", i, (unsigned) iterations, "string");
+}
+
+static void Teardown_Print(void)
+{
+    g_serialMirror = s_savedMirror;
+}
+
+static struct Benchmark s_benchmarks[] = {
+    { "ctx-switch",     Bench_Context_Switch,  1000, Setup_Context_Switch,  Teardown_Context_Switch },
+    { "mutex-lock",     Bench_Mutex_Lock,      1000, 0, 0 },
+    { "mutex-pingpong", Bench_Mutex_Ping_Pong, 1000, Setup_Mutex_Ping_Pong, Teardown_Mutex_Ping_Pong },
+    { "mutex-readers",  Bench_Readers,         400,  Setup_Mutex_Readers,   Stop_Readers },
+    { "rwlock-readers", Bench_Readers,         400,  Setup_RWLock_Readers,  Stop_Readers },
+    { "bcast-morph",    Bench_Broadcast,       100,  Setup_Broadcast_Morph, Stop_Waiters },
+    { "bcast-wake",     Bench_Broadcast,       100,  Setup_Broadcast_Wake,  Stop_Waiters },
+    { "spin",           Bench_Spin,            2000, Setup_Spin,            Teardown_Spin },
+    { "spin-shared",    Bench_Spin,            2000, Setup_CPU_Share,       Teardown_CPU_Share },
+    { "scale-one-cpu",  Bench_Scale,           840,  Setup_Scale_One,       Stop_Workers },
+    { "scale-all-cpus", Bench_Scale,           840,  Setup_Scale_All,       Stop_Workers },
+    { "malloc-free",    Bench_Malloc_Free,     1000, 0, 0 },
+    { "alloc-page",     Bench_Alloc_Page,      1000, 0, 0 },
+    { "memcpy-4k",      Bench_Memcpy,          100,  0, 0 },
+    { "crc32-4k",       Bench_CRC32,           100,  0, 0 },
+    { "print",          Bench_Print,           20,   Setup_Print,           Teardown_Print },
+};
+#define NUM_BENCHMARKS (sizeof(s_benchmarks) / sizeof(s_benchmarks[0]))
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Register the kernel's benchmarks.
+ */
+void Init_Kernel_Benchmarks(void)
+{
+    unsigned i;
+
+    Mutex_Init(&s_mutex);
+    Mutex_Register(&s_mutex, "bench");
+    memset(s_srcBuf, 0x5a, sizeof(s_srcBuf));
+
+    for (i = 0; i < NUM_BENCHMARKS; ++i)
+	Register_Benchmark(&s_benchmarks[i]);
+}
@@ -31,6 +31,13 @@ SETUPSEG equ 0x9020
 ; will be passed on the command line.
 KERNSEG equ 0x1000
 
+; Offset above KERNSEG at which the boot sector loads the kernel image.
+; It's zero unless the image is compressed (see src/tools/lzss.c),
+; in which case the setup code decompresses it in place to KERNSEG.
+%ifndef KERN_LOAD_OFFSET
+%define KERN_LOAD_OFFSET 0
+%endif
+
 ; Size of PFAT boot record.
 ; Keep up to date with <geekos/pfat.h>.
 PFAT_BOOT_RECORD_SIZE equ 28
@@ -41,6 +48,11 @@ BIOS_SIGNATURE_OFFSET equ 510
 ; Offset of PFAT boot record in boot sector.
 PFAT_BOOT_RECORD_OFFSET equ BIOS_SIGNATURE_OFFSET - PFAT_BOOT_RECORD_SIZE
 
+; Offset in the boot sector of the word where it records how many
+; BIOS timer ticks it took to load setup and the kernel.
+; The setup code passes this on to the kernel in the Boot_Info struct.
+LOAD_TICKS_OFFSET equ PFAT_BOOT_RECORD_OFFSET - 2
+
 ; Video memory segment
 VIDSEG equ 0xb800
 
@@ -80,4 +92,8 @@ KERNEL_DS equ 2<<3	; kernel data segment is GDT entry 2
 KERN_THREAD_OBJ equ (1024*1024)
 KERN_STACK equ KERN_THREAD_OBJ + 4096
 
+; Page where the application processors start executing.
+; Keep this up to date with defs.h.
+AP_TRAMPOLINE_ADDR equ 0x8000
+
 %endif
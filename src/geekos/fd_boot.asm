@@ -20,7 +20,10 @@
 
 %include "defs.asm"
 
-; Pad to desired offset from start symbol.
+; Pad to desired offset from start symbol.  If the code and data
+; already extend past the offset, the TIMES count is negative and
+; the boot sector fails to assemble rather than overlapping what
+; follows (loadTicks and the PFAT boot record).
 ;    Usage: Pad_From_Symbol offset, symbol
 %macro Pad_From_Symbol 2
 	times (%1 - ($ - %2)) db 0
@@ -61,157 +64,114 @@ after_move:
 	mov	ss, ax
 	mov	sp, (BOOTSEG << 4) + 512 - 2
 
+	; Note the BIOS timer tick count, so we can time the load.
+	xor	ah, ah
+	int	0x1a			; tick count in cx:dx
+	mov	[loadTicks], dx
+
 load_setup:
 	; Load the setup code.
-	mov	ax, word [setupStart]
-	mov	word [sec_count], ax
-	add	ax, [setupSize]
-	mov	word [max_sector], ax
-.again:
-	mov	ax, [sec_count]
-	push	ax			; 1st param to ReadSector (log sec num)
-	push	word SETUPSEG		; 2nd param to ReadSector (seg base)
-	sub	ax, [setupStart]	; convert to 0-indexed
-	shl	ax, 9			; multiply by 512
-	push	ax			;  ...to get 3rd param (byte offset)
-
-	; read the sector from the floppy
-	call	ReadSector
-	add	sp, 6			; clear 3 word params
-
-	; on to next sector
-	inc	word [sec_count]
-
-	; are we done?
-	mov	bx, word [max_sector]
-	cmp	word [sec_count], bx
-	jl	.again
+	mov	ax, [setupStart]
+	mov	cx, [setupSize]
+	mov	dx, SETUPSEG
+	call	ReadSectors
 
 load_kernel:
 	; Load the kernel image from sectors KERN_START_SEC..n of the
-	; floppy into memory at KERNSEG.  Note that there are 128 sectors
-	; per 64K segment.  So, when figuring out which segment to
-	; load the sector into, we shift right by 7 bits (which is
-	; equivalent to dividing by 128).
-
-	; Figure out start sector and max sector
-	mov	ax, word [kernelStart]
-	mov	word [sec_count], ax
-	add	ax, word [kernelSize]
-	mov	word [max_sector], ax
-.again:
-	mov	ax, [sec_count]		; logical sector on the floppy
-	push	ax			; 1st param to ReadSector (log sec num)
-	sub	ax, [kernelStart]	; convert to 0-indexed
-	mov	cx, ax			; save in cx
-	shr	ax, 7			; divide by 128
-	shl	ax, 12			;  ...and multiply by 0x1000
-	add	ax, KERNSEG		;  ...to get base relative to KERNSEG
-	push	ax			; 2nd param to ReadSector (seg base)
-	and	cx, 0x7f		; mod sector by 128
-	shl	cx, 9			;  ...and multiply by 512
-	push	cx			; to get offset in segment (3rd parm)
-
-	; read the sector from the floppy
-	call	ReadSector
-	add	sp, 6			; clear 3 word params
-
-	; on to next sector
-	inc	word [sec_count]
-
-	; have we loaded all of the sectors?
-	mov	bx, word [max_sector]
-	cmp	word [sec_count], bx
-	jl	.again
+	; floppy into memory at KERNSEG, or above it if it's compressed.
+	mov	ax, [kernelStart]
+	mov	cx, [kernelSize]
+	mov	dx, KERNSEG + (KERN_LOAD_OFFSET >> 4)
+	call	ReadSectors
+
+	; Record how many ticks the load took.
+	xor	ah, ah
+	int	0x1a
+	sub	dx, [loadTicks]
+	mov	[loadTicks], dx
 
 	; Now we've loaded the setup code and the kernel image.
 	; Jump to setup code.
 	jmp	SETUPSEG:0
 
-; Read a sector from the floppy drive.
-; This code (and the rest of this boot sector) will have to
-; be re-written at some point so it reads more than one
-; sector at a time.
+; Read consecutive sectors from the floppy drive into consecutive
+; memory.  Each BIOS call reads as many sectors as it can without
+; going past the end of the track or crossing a 64K boundary,
+; which the floppy DMA controller can't do.
 ;
 ; Parameters:
-;     - "logical" sector number   [bp+8]
-;     - destination segment       [bp+6]
-;     - destination offset        [bp+4]
-ReadSector:
-	push	bp			; set up stack frame
-	mov	bp, sp			; "
+;     ax - "logical" number of the first sector
+;     cx - number of sectors
+;     dx - destination segment (offset 0); must be a multiple
+;          of 512 bytes, so that no sector straddles a 64K boundary
+ReadSectors:
 	pusha				; save all registers
+	mov	[log_sec], ax
+	mov	[sec_count], cx
+	mov	[dest_seg], dx
 
-%if 0
-; debug params
-	mov	dx, [bp+8]
-	call	PrintHex
-	call	PrintNL
-	mov	dx, [bp+6]
-	call	PrintHex
-	call	PrintNL
-	mov	dx, [bp+4]
-	call	PrintHex
-	call	PrintNL
-%endif
+.nextRun:
+	cmp	word [sec_count], 0	; are we done?
+	je	.done
 
 	; Sector = log_sec % SECTORS_PER_TRACK
 	; Head = (log_sec / SECTORS_PER_TRACK) % HEADS
-	mov	ax, [bp+8]		; get logical sector number from stack
+	; Track = log_sec / (SECTORS_PER_TRACK*HEADS)
+	mov	ax, [log_sec]		; get logical sector number
 	xor	dx, dx			; dx is high part of dividend (== 0)
 	mov	bx, SECTORS_PER_TRACK	; divisor
 	div	bx			; do the division
 	mov	[sec], dx		; sector is the remainder
-	and	ax, 1			; same as mod by HEADS==2 (slight hack)
-	mov	[head], ax
-
-	; Track = log_sec / (SECTORS_PER_TRACK*HEADS)
-	mov	ax, [bp+8]		; get logical sector number again
-	xor	dx, dx			; dx is high part of dividend
-	mov	bx, SECTORS_PER_TRACK*2	; divisor
-	div	bx			; do the division
-	mov	[track], ax		; track is quotient
+	mov	[head], al
+	and	byte [head], 1		; same as mod by HEADS==2 (slight hack)
+	shr	ax, 1			; same as divide by HEADS==2
+	mov	[track], al
+
+	; Read up to the end of the track...
+	mov	ax, SECTORS_PER_TRACK
+	sub	ax, dx
+
+	; ...but not across a 64K boundary (32 paragraphs per sector)...
+	mov	bx, [dest_seg]
+	and	bx, 0x0fff		; paragraphs into the 64K block
+	neg	bx
+	add	bx, 0x1000		; paragraphs left in the 64K block
+	shr	bx, 5			;  ...divided by 32 gives sectors left
+	cmp	ax, bx
+	jbe	.checkCount
+	mov	ax, bx
+
+	; ...and no more than we were asked for.
+.checkCount:
+	cmp	ax, [sec_count]
+	jbe	.read
+	mov	ax, [sec_count]
 
-%if 0
-; debugging code
-	mov	dx, [sec]
-	call	PrintHex
-	call	PrintNL
-	mov	dx, [head]
-	call	PrintHex
-	call	PrintNL
-	mov	dx, [track]
-	call	PrintHex
-	call	PrintNL
-%endif
+.read:
+	mov	[num_secs], ax
 
-	; Now, try to actually read the sector from the floppy,
+	; Now, try to actually read the sectors from the floppy,
 	; retrying up to 3 times.
-
 	mov	[num_retries], byte 0
 
 .again:
-	mov	ax, [bp+6]		; dest segment...
-	mov	es, ax			;   goes in es
-	mov	ax, (0x02 << 8) | 1	; function = 02h in ah,
-					;   # secs = 1 in al
-	mov	bx, [track]		; track number...
-	mov	ch, bl			;   goes in ch
-	mov	bx, [sec]		; sector number...
-	mov	cl, bl			;   goes in cl...
+	mov	es, [dest_seg]		; dest segment goes in es
+	xor	bx, bx			; offset 0 goes in bx
+					;   (es:bx points to buffer)
+	mov	ax, [num_secs]		; # secs in al,
+	mov	ah, 0x02		;   function = 02h in ah
+	mov	ch, [track]		; track number goes in ch
+	mov	cl, [sec]		; sector number goes in cl...
 	inc	cl			;   but it must be 1-based, not 0-based
-	mov	bx, [head]		; head number...
-	mov	dh, bl			;   goes in dh
+	mov	dh, [head]		; head number goes in dh
 	xor	dl, dl			; hard code drive=0
-	mov	bx, [bp+4]		; offset goes in bx
-					;   (es:bx points to buffer)
 
 	; Call the BIOS Read Diskette Sectors service
 	int	0x13
 
 	; If the carry flag is NOT set, then there was no error
-	; and we're done.
-	jnc	.done
+	; and we're done with this run.
+	jnc	.advance
 
 	; Error - code stored in ah
 	mov	dx, ax
@@ -225,9 +185,17 @@ ReadSector:
 	call	PrintHex
 .here:	jmp	.here
 
+.advance:
+	; Move past the sectors we just read.
+	mov	ax, [num_secs]
+	add	[log_sec], ax
+	sub	[sec_count], ax
+	shl	ax, 5			; 32 paragraphs per sector
+	add	[dest_seg], ax
+	jmp	.nextRun
+
 .done:
 	popa				; restore all regisiters
-	pop	bp			; leave stack frame
 	ret
 
 ; Include utility routines
@@ -237,15 +205,22 @@ ReadSector:
 ; Variables
 ; ----------------------------------------------------------------------
 
-; These are used by ReadSector
-head: dw 0
-track: dw 0
+; These are used by ReadSectors
+head: db 0
+track: db 0
 sec: dw 0
+num_secs: dw 0
 num_retries: db 0
 
-; Used for loops reading sectors from floppy
+; Where the next run of sectors comes from and goes to
+log_sec: dw 0
 sec_count: dw 0
-max_sector: dw 0
+dest_seg: dw 0
+
+; BIOS timer ticks taken to load setup and the kernel.
+; The setup code finds this at a fixed offset.
+Pad_From_Symbol LOAD_TICKS_OFFSET, BeginText
+loadTicks: dw 0
 
 ; Padding to make the PFAT Boot Record sit just before the BIOS signature.
 Pad_From_Symbol PFAT_BOOT_RECORD_OFFSET, BeginText
@@ -12,6 +12,7 @@
 #include <geekos/int.h>
 #include <geekos/tss.h>
 #include <geekos/gdt.h>
+#include <geekos/smp.h>
 
 /*
  * This is defined in lowlevel.asm.
@@ -24,8 +25,9 @@ extern void Load_GDTR(ushort_t* limitAndBase);
 
 /*
  * Number of entries in the kernel GDT.
+ * Each processor needs a TSS and a per-CPU data segment.
  */
-#define NUM_GDT_ENTRIES 16
+#define NUM_GDT_ENTRIES (16 + 2 * MAX_CPUS)
 
 /*
  * This is the kernel's global descriptor table.
@@ -99,7 +101,6 @@ int Get_Descriptor_Index(struct Segment_Descriptor* desc)
 void Init_GDT(void)
 {
     ushort_t limitAndBase[3];
-    ulong_t gdtBaseAddr = (ulong_t) s_GDT;
     struct Segment_Descriptor* desc;
     int i;
 
@@ -133,8 +134,20 @@ void Init_GDT(void)
     KASSERT(Get_Descriptor_Index(desc) == (KERNEL_DS >> 3));
 
     /* Activate the kernel GDT. */
+    Get_GDTR(limitAndBase);
+    Load_GDTR(limitAndBase);
+}
+
+/*
+ * Get the 16 bit limit and 32 bit base address of the kernel GDT,
+ * in the form loaded into the GDTR.  The application processors
+ * load it in their startup code (see trampoline.asm).
+ */
+void Get_GDTR(ushort_t* limitAndBase)
+{
+    ulong_t gdtBaseAddr = (ulong_t) s_GDT;
+
     limitAndBase[0] = sizeof(struct Segment_Descriptor) * NUM_GDT_ENTRIES;
     limitAndBase[1] = gdtBaseAddr & 0xffff;
     limitAndBase[2] = gdtBaseAddr >> 16;
-    Load_GDTR(limitAndBase);
 }
@@ -10,13 +10,30 @@
 #include <geekos/idt.h>	 /* x86-specific int handling stuff */
 #include <geekos/screen.h>
 #include <geekos/kassert.h>
+#include <geekos/string.h>
+#include <geekos/cpu.h>
 #include <geekos/int.h>
+#include <geekos/smp.h>
 
 /*
  * Defined in lowlevel.asm.
  */
 ulong_t Get_Current_EFLAGS(void);
 
+/*
+ * Cycle counts for each interrupt's C handler.
+ * Public only because it is updated in lowlevel.asm;
+ * use Get_Interrupt_Stats() to read it.
+ */
+struct Interrupt_Stats g_interruptStats[ NUM_IDT_ENTRIES ];
+
+/*
+ * The kernel lock.  The boot processor starts with interrupts
+ * disabled, so it starts out holding the lock; Init_Interrupts()
+ * releases it when it enables interrupts.
+ */
+struct Spin_Lock g_kernelLock = { 1 };
+
 /* ----------------------------------------------------------------------
  * Private functions and data
  * ---------------------------------------------------------------------- */
@@ -43,6 +60,24 @@ static void Print_Selector(const char* regName, uint_t value)
  * Public functions
  * ---------------------------------------------------------------------- */
 
+/*
+ * Wait for the kernel lock, which another processor holds.
+ * The processor's struct CPU counts the waits and the cycles
+ * spent in them, so we can tell how much the processors get
+ * in each other's way (see Dump_Scheduler_Stats()).
+ * Called by Lock_Kernel(), and by the interrupt entry code
+ * in lowlevel.asm.
+ */
+void Lock_Kernel_Contended(void)
+{
+    struct CPU* cpu = Get_CPU();
+    ulong_t start = Read_TSC();
+
+    Spin_Lock(&g_kernelLock);
+    ++cpu->kernelLockWaits;
+    cpu->kernelLockWaitCycles += Read_TSC() - start;
+}
+
 /*
  * Initialize the interrupt system.
  */
@@ -102,3 +137,55 @@ void Dump_Interrupt_State(struct Interrupt_State* state)
     Print_Selector("fs", state->fs);
     Print_Selector("gs", state->gs);
 }
+
+/*
+ * Get a consistent copy of the handler statistics
+ * for given interrupt.
+ */
+void Get_Interrupt_Stats(int interrupt, struct Interrupt_Stats* stats)
+{
+    bool iflag;
+
+    KASSERT(interrupt >= 0 && interrupt < NUM_IDT_ENTRIES);
+
+    iflag = Begin_Int_Atomic();
+    *stats = g_interruptStats[interrupt];
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Clear the handler statistics for all interrupts.
+ */
+void Reset_Interrupt_Stats(void)
+{
+    bool iflag = Begin_Int_Atomic();
+    memset(g_interruptStats, '\0', sizeof(g_interruptStats));
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Print handler statistics for each interrupt that has occurred.
+ */
+void Dump_Interrupt_Stats(void)
+{
+    int i;
+    struct Interrupt_Stats stats;
+    unsigned long long scaled;
+
+    Print("int      count   avg cycles   max cycles  resched  resched%%\n");
+    for (i = 0; i < NUM_IDT_ENTRIES; ++i) {
+	Get_Interrupt_Stats(i, &stats);
+	if (stats.count == 0)
+	    continue;
+
+	/* Multiplication is fine on long longs; only division isn't. */
+	scaled = (unsigned long long) stats.reschedules * 100;
+
+	Print("%3d %10lu %12lu %12lu %8lu %9lu\n",
+	    i, stats.count,
+	    Divide_64(stats.totalCyclesHigh, stats.totalCyclesLow, stats.count),
+	    stats.maxCycles,
+	    stats.reschedules,
+	    Divide_64((ulong_t) (scaled >> 32), (ulong_t) scaled, stats.count));
+    }
+}
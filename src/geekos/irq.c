@@ -11,6 +11,8 @@
 #include <geekos/idt.h>
 #include <geekos/io.h>
 #include <geekos/irq.h>
+#include <geekos/trace.h>
+#include <geekos/apic.h>
 
 /* ----------------------------------------------------------------------
  * Private functions and data
@@ -23,6 +25,12 @@
  */
 static ushort_t s_irqMask = 0xfffb;
 
+/*
+ * Set once the I/O APIC has replaced the PICs
+ * (see Switch_To_IO_APIC()).
+ */
+static bool s_ioApicMode;
+
 /*
  * Get the master and slave parts of an IRQ mask.
  */
@@ -59,6 +67,12 @@ void Set_IRQ_Mask(ushort_t mask)
 {
     uchar_t oldMask, newMask;
 
+    if (s_ioApicMode) {
+	Set_IO_APIC_Mask(mask);
+	s_irqMask = mask;
+	return;
+    }
+
     oldMask = MASTER(s_irqMask);
     newMask = MASTER(mask);
     if (newMask != oldMask) {
@@ -104,23 +118,49 @@ void Disable_IRQ(int irq)
     End_Int_Atomic(iflag);
 }
 
+/*
+ * Deliver IRQs through the I/O APIC instead of the PICs,
+ * keeping the current mask.  The boot processor's local APIC
+ * must be enabled, and interrupts disabled.
+ */
+void Switch_To_IO_APIC(void)
+{
+    KASSERT(!Interrupts_Enabled());
+
+    /* Mask everything at the PICs; they are no longer used */
+    Out_Byte(0x21, 0xff);
+    Out_Byte(0xA1, 0xff);
+
+    Init_IO_APIC(s_irqMask);
+    s_ioApicMode = true;
+}
+
 /*
  * Called by an IRQ handler to begin the interrupt.
- * Currently a no-op.
+ * Currently just records a trace event.
  */
 void Begin_IRQ(struct Interrupt_State* state)
 {
+    TRACE(TRACE_IRQ_ENTER, state->intNum - FIRST_EXTERNAL_INT, 0);
 }
 
 /*
  * Called by an IRQ handler to end the interrupt.
- * Sends an EOI command to the appropriate PIC(s).
+ * Sends an EOI command to the appropriate PIC(s),
+ * or to the local APIC once the I/O APIC is in use.
  */
 void End_IRQ(struct Interrupt_State* state)
 {
     int irq = state->intNum - FIRST_EXTERNAL_INT;
     uchar_t command = 0x60 | (irq & 0x7);
 
+    TRACE(TRACE_IRQ_EXIT, irq, 0);
+
+    if (s_ioApicMode) {
+	Local_APIC_EOI();
+	return;
+    }
+
     if (irq < 8) {
 	/* Specific EOI to master PIC */
 	Out_Byte(0x20, command);
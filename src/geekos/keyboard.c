@@ -23,9 +23,9 @@
 
 /*
  * TODO list:
- * - Right now we're assuming an 83-key keyboard.
- *   Should add support for 101+ keyboards.
  * - Should toggle keyboard LEDs.
+ * - Keypad keys always produce navigation keycodes,
+ *   since we don't track the num lock state.
  */
 
 #include <geekos/kthread.h>
@@ -33,6 +33,9 @@
 #include <geekos/screen.h>
 #include <geekos/irq.h>
 #include <geekos/io.h>
+#include <geekos/cpu.h>
+#include <geekos/timer.h>
+#include <geekos/tasklet.h>
 #include <geekos/keyboard.h>
 
 /* ----------------------------------------------------------------------
@@ -56,12 +59,53 @@ static unsigned s_shiftState = 0;
 /*
  * Queue for keycodes, in case they arrive faster than consumer
  * can deal with them.
+ *
+ * This is a single-producer/single-consumer ring.  Only the
+ * keyboard tasklet advances s_queueTail, and only the consumer
+ * advances s_queueHead, so neither side has to disable interrupts
+ * to access the queue.  This means there must be only one thread
+ * reading keys at a time.  QUEUE_SIZE must be a power of two.
  */
 #define QUEUE_SIZE 256
-#define QUEUE_MASK 0xff
+#define QUEUE_MASK (QUEUE_SIZE - 1)
 #define NEXT(index) (((index) + 1) & QUEUE_MASK)
-static Keycode s_queue[QUEUE_SIZE];
-static int s_queueHead, s_queueTail;
+static struct Key_Event s_queue[QUEUE_SIZE];
+static volatile int s_queueHead, s_queueTail;
+
+/*
+ * Number of keycodes dropped because the queue was full.
+ */
+static volatile ulong_t s_queueOverflows;
+
+/*
+ * Keep the compiler from moving memory accesses across this point.
+ * The x86 doesn't reorder stores with other stores, so this is all
+ * we need to publish a queue slot before the index that covers it.
+ */
+#define BARRIER() __asm__ __volatile__ ("" : : : "memory")
+
+/*
+ * Raw scan codes captured by the interrupt handler, waiting
+ * to be decoded by the keyboard tasklet.  This is another
+ * single-producer/single-consumer ring: the handler is the
+ * producer and the tasklet is the consumer.
+ */
+#define RAW_QUEUE_SIZE 64
+#define RAW_QUEUE_MASK (RAW_QUEUE_SIZE - 1)
+#define RAW_NEXT(index) (((index) + 1) & RAW_QUEUE_MASK)
+struct Raw_Scan_Code {
+    uchar_t scanCode;
+    ulong_t ticks;
+    ulong_t tsc;
+};
+static struct Raw_Scan_Code s_rawQueue[RAW_QUEUE_SIZE];
+static volatile int s_rawQueueHead, s_rawQueueTail;
+static ulong_t s_rawQueueOverflows;
+
+/*
+ * Tasklet which decodes raw scan codes and wakes the consumer.
+ */
+static struct Tasklet s_keyboardTasklet;
 
 /*
  * Wait queue for thread(s) waiting for keyboard events.
@@ -69,66 +113,155 @@ static int s_queueHead, s_queueTail;
 static struct Thread_Queue s_waitQueue;
 
 /*
- * Translate from scan code to key code, when shift is not pressed.
- */
-static const Keycode s_scanTableNoShift[] = {
-    KEY_UNKNOWN, ASCII_ESC, '1', '2',   /* 0x00 - 0x03 */
-    '3', '4', '5', '6',                 /* 0x04 - 0x07 */
-    '7', '8', '9', '0',                 /* 0x08 - 0x0B */
-    '-', '=', ASCII_BS, '\t',           /* 0x0C - 0x0F */
-    'q', 'w', 'e', 'r',                 /* 0x10 - 0x13 */
-    't', 'y', 'u', 'i',                 /* 0x14 - 0x17 */
-    'o', 'p', '[', ']',                 /* 0x18 - 0x1B */
-    '\r', KEY_LCTRL, 'a', 's',          /* 0x1C - 0x1F */
-    'd', 'f', 'g', 'h',                 /* 0x20 - 0x23 */
-    'j', 'k', 'l', ';',                 /* 0x24 - 0x27 */
-    '\'', '`', KEY_LSHIFT, '\\',        /* 0x28 - 0x2B */
-    'z', 'x', 'c', 'v',                 /* 0x2C - 0x2F */
-    'b', 'n', 'm', ',',                 /* 0x30 - 0x33 */
-    '.', '/', KEY_RSHIFT, KEY_PRINTSCRN, /* 0x34 - 0x37 */
-    KEY_LALT, ' ', KEY_CAPSLOCK, KEY_F1, /* 0x38 - 0x3B */
-    KEY_F2, KEY_F3, KEY_F4, KEY_F5,     /* 0x3C - 0x3F */
-    KEY_F6, KEY_F7, KEY_F8, KEY_F9,     /* 0x40 - 0x43 */
-    KEY_F10, KEY_NUMLOCK, KEY_SCRLOCK, KEY_KPHOME,  /* 0x44 - 0x47 */
-    KEY_KPUP, KEY_KPPGUP, KEY_KPMINUS, KEY_KPLEFT,  /* 0x48 - 0x4B */
-    KEY_KPCENTER, KEY_KPRIGHT, KEY_KPPLUS, KEY_KPEND,  /* 0x4C - 0x4F */
-    KEY_KPDOWN, KEY_KPPGDN, KEY_KPINSERT, KEY_KPDEL,  /* 0x50 - 0x53 */
-    KEY_SYSREQ, KEY_UNKNOWN, KEY_UNKNOWN, KEY_UNKNOWN,  /* 0x54 - 0x57 */
-    KEY_UNKNOWN,KEY_UNKNOWN,KEY_UNKNOWN,KEY_UNKNOWN,
-    KEY_UNKNOWN,KEY_UNKNOWN,KEY_UNKNOWN,KEY_UNKNOWN,
-    KEY_UNKNOWN,KEY_UNKNOWN,KEY_UNKNOWN,KEY_UNKNOWN,
-    KEY_UNKNOWN,KEY_UNKNOWN,KEY_UNKNOWN,KEY_UNKNOWN
+ * Keystroke latency accounting.  The consumer remembers the
+ * timestamp of the last event it dequeued; when it reports that
+ * the resulting screen update is done, the elapsed cycles are
+ * added to a histogram with power-of-two buckets.
+ * Only the consumer thread touches these.
+ */
+#define NUM_LATENCY_BUCKETS 32
+static ulong_t s_lastEventTSC;
+static bool s_latencyPending;
+static ulong_t s_latencyHistogram[NUM_LATENCY_BUCKETS];
+static ulong_t s_latencyCount, s_latencyMin, s_latencyMax;
+
+/*
+ * Number of consumer wakeups done by the keyboard tasklet,
+ * and how many of them forced a reschedule.
+ */
+static ulong_t s_numWakeups, s_numPreemptions;
+
+/*
+ * Translate from scan code to key code.
+ * Each entry holds the unshifted and the shifted keycode,
+ * indexed by whether shift is pressed.
+ */
+#define UNSHIFTED 0
+#define SHIFTED   1
+static const Keycode s_scanTable[][2] = {
+    { KEY_UNKNOWN, KEY_UNKNOWN }, { ASCII_ESC, ASCII_ESC },	/* 0x00 - 0x01 */
+    { '1', '!' }, { '2', '@' }, { '3', '#' }, { '4', '$' },	/* 0x02 - 0x05 */
+    { '5', '%' }, { '6', '^' }, { '7', '&' }, { '8', '*' },	/* 0x06 - 0x09 */
+    { '9', '(' }, { '0', ')' }, { '-', '_' }, { '=', '+' },	/* 0x0A - 0x0D */
+    { ASCII_BS, ASCII_BS }, { '\t', '\t' },			/* 0x0E - 0x0F */
+    { 'q', 'Q' }, { 'w', 'W' }, { 'e', 'E' }, { 'r', 'R' },	/* 0x10 - 0x13 */
+    { 't', 'T' }, { 'y', 'Y' }, { 'u', 'U' }, { 'i', 'I' },	/* 0x14 - 0x17 */
+    { 'o', 'O' }, { 'p', 'P' }, { '[', '{' }, { ']', '}' },	/* 0x18 - 0x1B */
+    { '\r', '\r' }, { KEY_LCTRL, KEY_LCTRL },			/* 0x1C - 0x1D */
+    { 'a', 'A' }, { 's', 'S' },					/* 0x1E - 0x1F */
+    { 'd', 'D' }, { 'f', 'F' }, { 'g', 'G' }, { 'h', 'H' },	/* 0x20 - 0x23 */
+    { 'j', 'J' }, { 'k', 'K' }, { 'l', 'L' }, { ';', ':' },	/* 0x24 - 0x27 */
+    { '\'', '"' }, { '`', '~' }, { KEY_LSHIFT, KEY_LSHIFT },	/* 0x28 - 0x2A */
+    { '\\', '|' },						/* 0x2B */
+    { 'z', 'Z' }, { 'x', 'X' }, { 'c', 'C' }, { 'v', 'V' },	/* 0x2C - 0x2F */
+    { 'b', 'B' }, { 'n', 'N' }, { 'm', 'M' }, { ',', '<' },	/* 0x30 - 0x33 */
+    { '.', '>' }, { '/', '?' }, { KEY_RSHIFT, KEY_RSHIFT },	/* 0x34 - 0x36 */
+    { KEY_PRINTSCRN, KEY_PRINTSCRN },				/* 0x37 */
+    { KEY_LALT, KEY_LALT }, { ' ', ' ' },			/* 0x38 - 0x39 */
+    { KEY_CAPSLOCK, KEY_CAPSLOCK }, { KEY_F1, KEY_F1 },		/* 0x3A - 0x3B */
+    { KEY_F2, KEY_F2 }, { KEY_F3, KEY_F3 },			/* 0x3C - 0x3D */
+    { KEY_F4, KEY_F4 }, { KEY_F5, KEY_F5 },			/* 0x3E - 0x3F */
+    { KEY_F6, KEY_F6 }, { KEY_F7, KEY_F7 },			/* 0x40 - 0x41 */
+    { KEY_F8, KEY_F8 }, { KEY_F9, KEY_F9 },			/* 0x42 - 0x43 */
+    { KEY_F10, KEY_F10 }, { KEY_NUMLOCK, KEY_NUMLOCK },		/* 0x44 - 0x45 */
+    { KEY_SCRLOCK, KEY_SCRLOCK }, { KEY_KPHOME, KEY_KPHOME },	/* 0x46 - 0x47 */
+    { KEY_KPUP, KEY_KPUP }, { KEY_KPPGUP, KEY_KPPGUP },		/* 0x48 - 0x49 */
+    { KEY_KPMINUS, KEY_KPMINUS }, { KEY_KPLEFT, KEY_KPLEFT },	/* 0x4A - 0x4B */
+    { KEY_KPCENTER, KEY_KPCENTER }, { KEY_KPRIGHT, KEY_KPRIGHT },	/* 0x4C - 0x4D */
+    { KEY_KPPLUS, KEY_KPPLUS }, { KEY_KPEND, KEY_KPEND },	/* 0x4E - 0x4F */
+    { KEY_KPDOWN, KEY_KPDOWN }, { KEY_KPPGDN, KEY_KPPGDN },	/* 0x50 - 0x51 */
+    { KEY_KPINSERT, KEY_KPINSERT }, { KEY_KPDEL, KEY_KPDEL },	/* 0x52 - 0x53 */
+    { KEY_SYSREQ, KEY_SYSREQ }, { KEY_UNKNOWN, KEY_UNKNOWN },	/* 0x54 - 0x55 */
+    { KEY_UNKNOWN, KEY_UNKNOWN }, { KEY_F11, KEY_F11 },		/* 0x56 - 0x57 */
+    { KEY_F12, KEY_F12 },					/* 0x58 */
+};
+#define SCAN_TABLE_SIZE (sizeof(s_scanTable) / sizeof(s_scanTable[0]))
+
+/*
+ * Translate from the second byte of an 0xE0-prefixed (extended)
+ * scan code to key code.  Zero entries are ignored; this includes
+ * the fake shift codes that some keyboards send around the
+ * navigation keys.
+ */
+static const Keycode s_extScanTable[] = {
+    [0x1C] = '\r',		/* keypad enter */
+    [0x1D] = KEY_RCTRL,
+    [0x35] = '/',		/* keypad divide */
+    [0x38] = KEY_RALT,
+    [0x47] = KEY_HOME,
+    [0x48] = KEY_UP,
+    [0x49] = KEY_PGUP,
+    [0x4B] = KEY_LEFT,
+    [0x4D] = KEY_RIGHT,
+    [0x4F] = KEY_END,
+    [0x50] = KEY_DOWN,
+    [0x51] = KEY_PGDN,
+    [0x52] = KEY_INSERT,
+    [0x53] = KEY_DELETE,
 };
-#define SCAN_TABLE_SIZE (sizeof(s_scanTableNoShift) / sizeof(Keycode))
-
-/*
- * Translate from scan code to key code, when shift *is* pressed.
- * Keep this in sync with the unshifted table above!
- * They must be the same size.
- */
-static const Keycode s_scanTableWithShift[] = {
-    KEY_UNKNOWN, ASCII_ESC, '!', '@',   /* 0x00 - 0x03 */
-    '#', '$', '%', '^',                 /* 0x04 - 0x07 */
-    '&', '*', '(', ')',                 /* 0x08 - 0x0B */
-    '_', '+', ASCII_BS, '\t',           /* 0x0C - 0x0F */
-    'Q', 'W', 'E', 'R',                 /* 0x10 - 0x13 */
-    'T', 'Y', 'U', 'I',                 /* 0x14 - 0x17 */
-    'O', 'P', '{', '}',                 /* 0x18 - 0x1B */
-    '\r', KEY_LCTRL, 'A', 'S',          /* 0x1C - 0x1F */
-    'D', 'F', 'G', 'H',                 /* 0x20 - 0x23 */
-    'J', 'K', 'L', ':',                 /* 0x24 - 0x27 */
-    '"', '~', KEY_LSHIFT, '|',          /* 0x28 - 0x2B */
-    'Z', 'X', 'C', 'V',                 /* 0x2C - 0x2F */
-    'B', 'N', 'M', '<',                 /* 0x30 - 0x33 */
-    '>', '?', KEY_RSHIFT, KEY_PRINTSCRN, /* 0x34 - 0x37 */
-    KEY_LALT, ' ', KEY_CAPSLOCK, KEY_F1, /* 0x38 - 0x3B */
-    KEY_F2, KEY_F3, KEY_F4, KEY_F5,     /* 0x3C - 0x3F */
-    KEY_F6, KEY_F7, KEY_F8, KEY_F9,     /* 0x40 - 0x43 */
-    KEY_F10, KEY_NUMLOCK, KEY_SCRLOCK, KEY_KPHOME,  /* 0x44 - 0x47 */
-    KEY_KPUP, KEY_KPPGUP, KEY_KPMINUS, KEY_KPLEFT,  /* 0x48 - 0x4B */
-    KEY_KPCENTER, KEY_KPRIGHT, KEY_KPPLUS, KEY_KPEND,  /* 0x4C - 0x4F */
-    KEY_KPDOWN, KEY_KPPGDN, KEY_KPINSERT, KEY_KPDEL,  /* 0x50 - 0x53 */
-    KEY_SYSREQ, KEY_UNKNOWN, KEY_UNKNOWN, KEY_UNKNOWN,  /* 0x54 - 0x57 */
+#define EXT_SCAN_TABLE_SIZE (sizeof(s_extScanTable) / sizeof(Keycode))
+
+/*
+ * Scan code prefix bytes.
+ * 0xE0 introduces a two byte extended code.
+ * 0xE1 introduces the six byte pause key sequence.
+ */
+#define SCAN_PREFIX_EXT   0xE0
+#define SCAN_PREFIX_PAUSE 0xE1
+#define PAUSE_SEQUENCE_LEN 5
+
+/*
+ * Scan code decoder state.
+ */
+enum Decode_State {
+    DS_NORMAL,		/* Expecting the first byte of a scan code */
+    DS_EXT,		/* Saw 0xE0 prefix */
+    DS_PAUSE,		/* Skipping the rest of the pause sequence */
+};
+static enum Decode_State s_decodeState = DS_NORMAL;
+static int s_pauseBytesLeft;
+
+/*
+ * Number of scan codes we couldn't translate.
+ */
+static ulong_t s_numUnknownScanCodes;
+
+/*
+ * Command classification for special keys,
+ * indexed by the low 8 bits of the keycode.
+ */
+static const uchar_t s_commandTable[256] = {
+    [KEY_F1 & 0xff] = COMMAND_F1,
+    [KEY_F2 & 0xff] = COMMAND_F2,
+    [KEY_F3 & 0xff] = COMMAND_F3,
+    [KEY_F4 & 0xff] = COMMAND_F4,
+    [KEY_F5 & 0xff] = COMMAND_F5,
+    [KEY_F6 & 0xff] = COMMAND_F6,
+    [KEY_F7 & 0xff] = COMMAND_F7,
+    [KEY_F8 & 0xff] = COMMAND_F8,
+    [KEY_F9 & 0xff] = COMMAND_F9,
+    [KEY_F10 & 0xff] = COMMAND_F10,
+    [KEY_F11 & 0xff] = COMMAND_F11,
+    [KEY_F12 & 0xff] = COMMAND_F12,
+    [KEY_UP & 0xff] = COMMAND_MOVE_UP,
+    [KEY_DOWN & 0xff] = COMMAND_MOVE_DOWN,
+    [KEY_LEFT & 0xff] = COMMAND_MOVE_LEFT,
+    [KEY_RIGHT & 0xff] = COMMAND_MOVE_RIGHT,
+    [KEY_HOME & 0xff] = COMMAND_HOME,
+    [KEY_END & 0xff] = COMMAND_END,
+    [KEY_PGUP & 0xff] = COMMAND_PAGE_UP,
+    [KEY_PGDN & 0xff] = COMMAND_PAGE_DOWN,
+    [KEY_DELETE & 0xff] = COMMAND_DELETE,
+    [KEY_SCRLOCK & 0xff] = COMMAND_SCROLL_LOCK,
+    [KEY_KPUP & 0xff] = COMMAND_MOVE_UP,
+    [KEY_KPDOWN & 0xff] = COMMAND_MOVE_DOWN,
+    [KEY_KPLEFT & 0xff] = COMMAND_MOVE_LEFT,
+    [KEY_KPRIGHT & 0xff] = COMMAND_MOVE_RIGHT,
+    [KEY_KPHOME & 0xff] = COMMAND_HOME,
+    [KEY_KPEND & 0xff] = COMMAND_END,
+    [KEY_KPPGUP & 0xff] = COMMAND_PAGE_UP,
+    [KEY_KPPGDN & 0xff] = COMMAND_PAGE_DOWN,
+    [KEY_KPDEL & 0xff] = COMMAND_DELETE,
 };
 
 static __inline__ bool Is_Queue_Empty(void)
@@ -141,120 +274,251 @@ static __inline__ bool Is_Queue_Full(void)
     return NEXT(s_queueTail) == s_queueHead;
 }
 
-static __inline__ void Enqueue_Keycode(Keycode keycode)
+/*
+ * Add a keycode to the queue, along with the time
+ * at which its interrupt arrived.
+ * Only called from the keyboard tasklet (the producer).
+ */
+static __inline__ void Enqueue_Keycode(Keycode keycode, ulong_t ticks, ulong_t tsc)
 {
-    if (!Is_Queue_Full()) {
-	s_queue[ s_queueTail ] = keycode;
-	s_queueTail = NEXT(s_queueTail);
+    struct Key_Event* event;
+
+    if (Is_Queue_Full()) {
+	++s_queueOverflows;
+	return;
     }
+
+    event = &s_queue[ s_queueTail ];
+    event->keycode = keycode;
+    event->ticks = ticks;
+    event->tsc = tsc;
+    BARRIER();
+    s_queueTail = NEXT(s_queueTail);
 }
 
-static __inline__ Keycode Dequeue_Keycode(void)
+/*
+ * Remove an event from the queue.
+ * Only called by the consumer thread.
+ */
+static __inline__ void Dequeue_Event(struct Key_Event* event)
 {
-    Keycode result;
     KASSERT(!Is_Queue_Empty());
-    result = s_queue[ s_queueHead ];
+    *event = s_queue[ s_queueHead ];
+    BARRIER();
     s_queueHead = NEXT(s_queueHead);
-    return result;
+
+    s_lastEventTSC = event->tsc;
+    s_latencyPending = true;
+}
+
+static __inline__ Keycode Dequeue_Keycode(void)
+{
+    struct Key_Event event;
+    Dequeue_Event(&event);
+    return event.keycode;
 }
 
 /*
- * Handler for keyboard interrupts.
+ * Block until the queue is not empty.
+ * The test is repeated with interrupts disabled before
+ * waiting, so we can't miss the wakeup from the keyboard tasklet.
  */
-static void Keyboard_Interrupt_Handler(struct Interrupt_State* state)
+static void Wait_For_Keycodes(void)
 {
-    uchar_t status, scanCode;
-    unsigned flag = 0;
-    bool release = false, shift;
-    Keycode keycode;
+    bool iflag;
 
-    Begin_IRQ(state);
+    if (!Is_Queue_Empty())
+	return;
 
-    status = In_Byte(KB_CMD);
-    IO_Delay();
+    iflag = Begin_Int_Atomic();
+    while (Is_Queue_Empty())
+	Wait(&s_waitQueue);
+    End_Int_Atomic(iflag);
+}
 
-    if ((status & KB_OUTPUT_FULL) != 0) {
-	/* There is a byte available */
-	scanCode = In_Byte(KB_DATA);
-	IO_Delay();
 /*
- *	Print("code=%x%s\n", scanCode, (scanCode&0x80) ? " [release]" : "");
+ * Wake the highest priority thread waiting for a key.
+ * Only ask for a new thread to be picked on return from the
+ * interrupt if the woken thread outranks the current one;
+ * otherwise it just waits its turn on the run queue.
+ * Must be called with interrupts disabled.
  */
+static void Wake_Key_Consumer(void)
+{
+    struct Kernel_Thread* woken = Wake_Up_One(&s_waitQueue);
 
-	if (scanCode & KB_KEY_RELEASE) {
-	    release = true;
-	    scanCode &= ~(KB_KEY_RELEASE);
-	}
+    if (woken == 0)
+	return;
 
-	if (scanCode >= SCAN_TABLE_SIZE) {
-	    Print("Unknown scan code: %x\n", scanCode);
-	    goto done;
-	}
+    ++s_numWakeups;
+    if (woken->cpu == Get_CPU()->id && woken->priority > g_currentThread->priority) {
+	g_needReschedule = true;
+	++s_numPreemptions;
+    }
+}
 
-	/* Process the key */
-	shift = ((s_shiftState & SHIFT_MASK) != 0);
-	keycode = shift ? s_scanTableWithShift[scanCode] : s_scanTableNoShift[scanCode];
-
-	/* Update shift, control and alt state */
-	switch (keycode) {
-	case KEY_LSHIFT:
-	    flag = LEFT_SHIFT;
-	    break;
-	case KEY_RSHIFT:
-	    flag = RIGHT_SHIFT;
-	    break;
-	case KEY_LCTRL:
-	    flag = LEFT_CTRL;
-	    break;
-	case KEY_RCTRL:
-	    flag = RIGHT_CTRL;
-	    break;
-	case KEY_LALT:
-	    flag = LEFT_ALT;
-	    break;
-	case KEY_RALT:
-	    flag = RIGHT_ALT;
-	    break;
-	default:
-	    goto noflagchange;
+/*
+ * Feed one byte from the keyboard controller through the
+ * scan code decoder.  Returns true if a complete key event
+ * was decoded, storing its keycode (with flags) in *keycode.
+ * Modifier keys only update the shift state, and are not reported.
+ */
+static bool Decode_Scan_Code(uchar_t scanCode, Keycode* keycode)
+{
+    unsigned flag;
+    bool release, shift;
+    Keycode code;
+
+    switch (s_decodeState) {
+    case DS_PAUSE:
+	if (--s_pauseBytesLeft == 0)
+	    s_decodeState = DS_NORMAL;
+	return false;
+
+    case DS_NORMAL:
+	if (scanCode == SCAN_PREFIX_EXT) {
+	    s_decodeState = DS_EXT;
+	    return false;
+	}
+	if (scanCode == SCAN_PREFIX_PAUSE) {
+	    s_decodeState = DS_PAUSE;
+	    s_pauseBytesLeft = PAUSE_SEQUENCE_LEN;
+	    return false;
 	}
+	break;
 
+    case DS_EXT:
+	break;
+
+    default:
+	KASSERT(false);
+    }
+
+    release = (scanCode & KB_KEY_RELEASE) != 0;
+    scanCode &= ~(KB_KEY_RELEASE);
+    shift = ((s_shiftState & SHIFT_MASK) != 0);
+
+    if (s_decodeState == DS_EXT) {
+	s_decodeState = DS_NORMAL;
+	code = (scanCode < EXT_SCAN_TABLE_SIZE) ? s_extScanTable[scanCode] : KEY_UNKNOWN;
+	if (code == 0)
+	    return false;
+    } else {
+	code = (scanCode < SCAN_TABLE_SIZE) ? s_scanTable[scanCode][shift ? SHIFTED : UNSHIFTED]
+	    : KEY_UNKNOWN;
+    }
+
+    if (code == KEY_UNKNOWN) {
+	++s_numUnknownScanCodes;
+	return false;
+    }
+
+    /* Update shift, control and alt state */
+    switch (code) {
+    case KEY_LSHIFT: flag = LEFT_SHIFT; break;
+    case KEY_RSHIFT: flag = RIGHT_SHIFT; break;
+    case KEY_LCTRL:  flag = LEFT_CTRL; break;
+    case KEY_RCTRL:  flag = RIGHT_CTRL; break;
+    case KEY_LALT:   flag = LEFT_ALT; break;
+    case KEY_RALT:   flag = RIGHT_ALT; break;
+    default:         flag = 0; break;
+    }
+
+    if (flag != 0) {
 	if (release)
 	    s_shiftState &= ~(flag);
 	else
 	    s_shiftState |= flag;
-			
+
 	/*
 	 * Shift, control and alt keys don't have to be
 	 * queued, flags will be set!
 	 */
-	goto done;
-
-noflagchange:
-	/* Format the new keycode */
-	if (shift)
-	    keycode |= KEY_SHIFT_FLAG;
-	if ((s_shiftState & CTRL_MASK) != 0)
-	    keycode |= KEY_CTRL_FLAG;
-	if ((s_shiftState & ALT_MASK) != 0)
-	    keycode |= KEY_ALT_FLAG;
-	if (release)
-	    keycode |= KEY_RELEASE_FLAG;
-		
-	/* Put the keycode in the buffer */
-	Enqueue_Keycode(keycode);
+	return false;
+    }
 
-	/* Wake up event consumers */
-	Wake_Up(&s_waitQueue);
+    /* Format the new keycode */
+    if (shift)
+	code |= KEY_SHIFT_FLAG;
+    if ((s_shiftState & CTRL_MASK) != 0)
+	code |= KEY_CTRL_FLAG;
+    if ((s_shiftState & ALT_MASK) != 0)
+	code |= KEY_ALT_FLAG;
+    if (release)
+	code |= KEY_RELEASE_FLAG;
+
+    *keycode = code;
+    return true;
+}
 
-	/*
-	 * Pick a new thread upon return from interrupt
-	 * (hopefully the one waiting for the keyboard event)
-	 */
-	g_needReschedule = true;
+/*
+ * Keyboard bottom half.
+ * Decodes the scan codes captured by the interrupt handler,
+ * queues the resulting keycodes, and wakes the consumer.
+ * Runs with interrupts enabled.
+ */
+static void Keyboard_Tasklet(ulong_t arg)
+{
+    bool queued = false;
+
+    while (s_rawQueueHead != s_rawQueueTail) {
+	struct Raw_Scan_Code raw = s_rawQueue[ s_rawQueueHead ];
+	Keycode keycode;
+
+	BARRIER();
+	s_rawQueueHead = RAW_NEXT(s_rawQueueHead);
+
+	if (Decode_Scan_Code(raw.scanCode, &keycode)) {
+	    Enqueue_Keycode(keycode, raw.ticks, raw.tsc);
+	    queued = true;
+	}
+    }
+
+    if (queued) {
+	/* Wake up the event consumer, if it is waiting */
+	bool iflag = Begin_Int_Atomic();
+	Wake_Key_Consumer();
+	End_Int_Atomic(iflag);
+    }
+}
+
+/*
+ * Handler for keyboard interrupts.
+ * Just grabs the scan code and leaves the rest
+ * to the keyboard tasklet.
+ */
+static void Keyboard_Interrupt_Handler(struct Interrupt_State* state)
+{
+    uchar_t status, scanCode;
+    ulong_t tsc = Read_TSC();
+
+    Begin_IRQ(state);
+
+    status = In_Byte(KB_CMD);
+    IO_Delay();
+
+    if ((status & KB_OUTPUT_FULL) != 0) {
+	/* There is a byte available */
+	scanCode = In_Byte(KB_DATA);
+	IO_Delay();
+/*
+ *	Print("code=%x%s\n", scanCode, (scanCode&0x80) ? " [release]" : "");
+ */
+
+	if (RAW_NEXT(s_rawQueueTail) == s_rawQueueHead) {
+	    ++s_rawQueueOverflows;
+	} else {
+	    struct Raw_Scan_Code* raw = &s_rawQueue[ s_rawQueueTail ];
+	    raw->scanCode = scanCode;
+	    raw->ticks = g_numTicks;
+	    raw->tsc = tsc;
+	    BARRIER();
+	    s_rawQueueTail = RAW_NEXT(s_rawQueueTail);
+	}
+
+	Schedule_Tasklet(&s_keyboardTasklet);
     }
 
-done:
     End_IRQ(state);
 }
 
@@ -270,9 +534,14 @@ void Init_Keyboard(void)
 
     /* Start out with no shift keys enabled. */
     s_shiftState = 0;
+    s_decodeState = DS_NORMAL;
 
     /* Buffer is initially empty. */
     s_queueHead = s_queueTail = 0;
+    s_queueOverflows = 0;
+    s_rawQueueHead = s_rawQueueTail = 0;
+    s_rawQueueOverflows = 0;
+    Init_Tasklet(&s_keyboardTasklet, Keyboard_Tasklet, 0);
 
     /* Install interrupt handler */
     Install_IRQ(KB_IRQ, Keyboard_Interrupt_Handler);
@@ -292,18 +561,30 @@ void Init_Keyboard(void)
  */
 bool Read_Key(Keycode* keycode)
 {
-    bool result, iflag;
+    if (Is_Queue_Empty())
+	return false;
 
-    iflag = Begin_Int_Atomic();
+    *keycode = Dequeue_Keycode();
+    return true;
+}
 
-    result = !Is_Queue_Empty();
-    if (result) {
-	*keycode = Dequeue_Keycode();
-    }
+/*
+ * Wait for at least one keycode to arrive, then
+ * drain as many queued keycodes as will fit in buf.
+ * Returns the number of keycodes stored, which is
+ * always between 1 and max.
+ */
+int Read_Keys(Keycode* buf, int max)
+{
+    int count = 0;
 
-    End_Int_Atomic(iflag);
+    KASSERT(max > 0);
+
+    Wait_For_Keycodes();
+    while (count < max && !Is_Queue_Empty())
+	buf[count++] = Dequeue_Keycode();
 
-    return result;
+    return count;
 }
 
 /*
@@ -313,21 +594,124 @@ bool Read_Key(Keycode* keycode)
  */
 Keycode Wait_For_Key(void)
 {
-    bool gotKey, iflag;
-    Keycode keycode = KEY_UNKNOWN;
+    Wait_For_Keycodes();
+    return Dequeue_Keycode();
+}
 
-    iflag = Begin_Int_Atomic();
+/*
+ * Wait for the next key press, and classify it for a
+ * line-oriented consumer such as the editor.  Key releases
+ * are skipped.  If the key should be inserted as text,
+ * its character is returned and *type is set to
+ * COMMAND_NO_OPERATION.  Otherwise zero is returned and
+ * *type says which command the key stands for
+ * (COMMAND_NO_OPERATION if it should be ignored).
+ */
+Keycode Get_From_Keyboard(COMMAND_TYPE* type)
+{
+    Keycode keycode;
 
     do {
-	gotKey = !Is_Queue_Empty();
-	if (gotKey)
-	    keycode = Dequeue_Keycode();
-	else
-	    Wait(&s_waitQueue);
+	keycode = Wait_For_Key();
     }
-    while (!gotKey);
+    while ((keycode & KEY_RELEASE_FLAG) != 0);
 
-    End_Int_Atomic(iflag);
+    *type = COMMAND_NO_OPERATION;
+
+    if ((keycode & KEY_SPECIAL_FLAG) != 0) {
+	*type = s_commandTable[keycode & 0xff];
+	return 0;
+    }
+
+    if ((keycode & (KEY_CTRL_FLAG | KEY_ALT_FLAG)) != 0) {
+	if ((keycode & KEY_CTRL_FLAG) != 0 && TOLOWER(keycode & 0xff) == 'd')
+	    *type = COMMAND_CTRL_D;
+	else if ((keycode & KEY_CTRL_FLAG) != 0 && TOLOWER(keycode & 0xff) == 'p')
+	    *type = COMMAND_CTRL_P;
+	return 0;
+    }
+
+    switch (keycode & 0xff) {
+    case ASCII_BS:
+	*type = COMMAND_BACKSPACE;
+	return 0;
+    case ASCII_ESC:
+	return 0;
+    case '\r':
+	return '\n';
+    default:
+	return keycode & 0xff;
+    }
+}
 
-    return keycode;
+/*
+ * Poll for a key event, including the time at which
+ * the key's interrupt arrived.  Returns true if an event
+ * was stored in the location pointed to by event,
+ * false if no event is available.
+ */
+bool Read_Key_Event(struct Key_Event* event)
+{
+    if (Is_Queue_Empty())
+	return false;
+
+    Dequeue_Event(event);
+    return true;
+}
+
+/*
+ * Called by the consumer once the screen has been updated
+ * in response to the key it read most recently.  Records
+ * the time from that key's interrupt to now.  Does nothing
+ * if no key has been read since the last call.
+ */
+void Record_Key_Latency(void)
+{
+    ulong_t cycles;
+    int bucket = 0;
+
+    if (!s_latencyPending)
+	return;
+    s_latencyPending = false;
+
+    cycles = Read_TSC() - s_lastEventTSC;
+    while (bucket < NUM_LATENCY_BUCKETS - 1 && (cycles >> (bucket + 1)) != 0)
+	++bucket;
+    ++s_latencyHistogram[bucket];
+
+    if (s_latencyCount == 0 || cycles < s_latencyMin)
+	s_latencyMin = cycles;
+    if (cycles > s_latencyMax)
+	s_latencyMax = cycles;
+    ++s_latencyCount;
+}
+
+/*
+ * Print keyboard statistics and the keystroke latency histogram.
+ * Each histogram line counts the keystrokes whose interrupt-to-screen
+ * latency was at least 2^n cycles, but less than 2^(n+1).
+ */
+void Dump_Keyboard_Stats(void)
+{
+    int i;
+
+    Print("%lu wakeups, %lu forced a reschedule, %lu context switches avoided\n",
+	s_numWakeups, s_numPreemptions, s_numWakeups - s_numPreemptions);
+    Print("%lu unknown scan codes, %lu scan codes dropped\n",
+	s_numUnknownScanCodes, s_rawQueueOverflows);
+    Print("%lu keystrokes, min=%lu max=%lu cycles, %lu dropped\n",
+	s_latencyCount, s_latencyMin, s_latencyMax, s_queueOverflows);
+    for (i = 0; i < NUM_LATENCY_BUCKETS; ++i) {
+	if (s_latencyHistogram[i] != 0)
+	    Print("  >= 2^%-2d cycles: %lu\n", i, s_latencyHistogram[i]);
+    }
+}
+
+/*
+ * Get the number of keycodes that were discarded
+ * because the queue was full.
+ */
+ulong_t Get_Key_Overflow_Count(void)
+{
+    return s_queueOverflows;
 }
@@ -15,7 +15,14 @@
 #include <geekos/symbol.h>
 #include <geekos/string.h>
 #include <geekos/kthread.h>
+#include <geekos/synch.h>
+#include <geekos/timer.h>
+#include <geekos/cpu.h>
+#include <geekos/trace.h>
 #include <geekos/malloc.h>
+#include <geekos/smp.h>
+#include <geekos/apic.h>
+#include <geekos/errno.h>
 
 
 /* ----------------------------------------------------------------------
@@ -28,28 +35,73 @@
 static struct All_Thread_List s_allThreadList;
 
 /*
- * Queue of runnable threads.
+ * Run queues, one per processor: runnable threads, with a queue
+ * for each priority level, a bitmap of the levels that have
+ * at least one thread, and the fair-share threads in a heap
+ * (see below).  Adding a thread and finding the best one
+ * to run take constant time.  Like all scheduler state,
+ * they are protected by the kernel lock.
  */
-static struct Thread_Queue s_runQueue;
+struct Run_Queue {
+    struct Thread_Queue level[NUM_PRIORITY_LEVELS];
+    ulong_t nonEmptyLevels;
+    struct Kernel_Thread* fairRoot;
+    int numThreads;
+};
+static struct Run_Queue s_runQueue[MAX_CPUS];
 
 /*
- * Current thread.
+ * Scheduling policy, chosen when the kernel is built.
  */
-struct Kernel_Thread* g_currentThread;
+#ifndef DEFAULT_SCHED_POLICY
+#  define DEFAULT_SCHED_POLICY SCHED_PRIORITY
+#endif
+enum Sched_Policy g_schedPolicy = DEFAULT_SCHED_POLICY;
 
 /*
- * Boolean flag indicating that we need to choose a new runnable thread.
- * It is checked by the interrupt return code (Handle_Interrupt,
- * in lowlevel.asm) before returning from an interrupt.
+ * Fair-share scheduler state.
+ * Runnable threads are kept in a skew heap ordered by vruntime,
+ * one per run queue.
+ * s_fairMinVruntime never decreases: it tracks the vruntime of
+ * the threads being run, and is used to place threads which
+ * have been asleep, so they can't build up an unfair credit.
+ * Each processor records when its current thread was last charged
+ * for its CPU time, in its struct CPU.
  */
-int g_needReschedule;
+static unsigned long long s_fairMinVruntime;
 
 /*
- * Boolean flag indicating that preemption is disabled.
- * When set, external interrupts (such as the timer tick)
- * will not cause a new thread to be selected.
+ * Most vruntime a woken thread may have below s_fairMinVruntime:
+ * about a millisecond on a current processor.
  */
-volatile int g_preemptionDisabled;
+#define FAIR_SLEEPER_CREDIT (1UL << 20)
+
+/*
+ * Weight of each priority level: a thread's vruntime advances
+ * by FAIR_WEIGHT_NORMAL / weight times the cycles it runs.
+ * Each level gets 25% more CPU than the one below it.
+ */
+#define FAIR_WEIGHT_NORMAL 1024
+static const ulong_t s_fairWeight[NUM_PRIORITY_LEVELS] = {
+    64, 419, 524, 655, 819, 1024, 1280, 1600, 2000, 2500, 3125
+};
+
+/*
+ * The current thread, and the flags saying that a new runnable
+ * thread must be chosen (checked by the interrupt return code,
+ * Handle_Interrupt in lowlevel.asm) and that preemption is disabled,
+ * are kept per processor, in struct CPU (see kthread.h).
+ */
+
+/*
+ * Number of times Get_Next_Runnable() picked a thread
+ * other than the current one, number of threads taken from
+ * another processor's run queue, and number of reschedule
+ * interrupts sent to other processors.
+ */
+ulong_t g_numContextSwitches;
+ulong_t g_numThreadsStolen;
+ulong_t g_numReschedIPIs;
 
 /*
  * Queue of finished threads needing disposal,
@@ -59,6 +111,11 @@ volatile int g_preemptionDisabled;
 static struct Thread_Queue s_graveyardQueue;
 static struct Thread_Queue s_reaperWaitQueue;
 
+/*
+ * Threads waiting in Wait_Timeout().
+ */
+static struct Timeout_List s_timeoutList;
+
 /*
  * Counter for keys that access thread-local data, and an array
  * of destructors for freeing that data when the thread dies.  This is
@@ -86,6 +143,12 @@ static void Init_Thread(struct Kernel_Thread* kthread, void* stackPage,
     kthread->esp = ((ulong_t) kthread->stackPage) + PAGE_SIZE;
     kthread->numTicks = 0;
     kthread->priority = priority;
+    kthread->basePriority = priority;
+    kthread->blockedOn = 0;
+    Clear_Held_Mutex_List(&kthread->heldMutexes);
+    kthread->vruntime = s_fairMinVruntime;
+    kthread->cpu = Get_CPU()->id;
+    kthread->affinity = ALL_CPUS;
     kthread->userContext = 0;
     kthread->owner = owner;
 
@@ -110,6 +173,7 @@ static struct Kernel_Thread* Create_Thread(int priority, bool detached)
 {
     struct Kernel_Thread* kthread;
     void* stackPage = 0;
+    bool iflag;
 
     /*
      * For now, just allocate one page each for the thread context
@@ -131,12 +195,13 @@ static struct Kernel_Thread* Create_Thread(int priority, bool detached)
 
     /*
      * Initialize the stack pointer of the new thread
-     * and accounting info
+     * and accounting info, and add it to the list of all
+     * threads in the system.  Both touch shared data.
      */
+    iflag = Begin_Int_Atomic();
     Init_Thread(kthread, stackPage, priority, detached);
-
-    /* Add to the list of all threads in the system. */
     Add_To_Back_Of_All_Thread_List(&s_allThreadList, kthread);
+    End_Int_Atomic(iflag);
 
     return kthread;
 }
@@ -288,8 +353,9 @@ static void Setup_Kernel_Thread(
     /*
      * Push values for saved segment registers.
      * Only the ds and es registers will contain valid selectors.
-     * The fs and gs registers are not used by any instruction
-     * generated by gcc.
+     * The fs register is set to the per-CPU segment of whichever
+     * processor runs the thread (see lowlevel.asm), and gs is not
+     * used by any instruction generated by gcc.
      */
     Push(kthread, KERNEL_DS);  /* ds */
     Push(kthread, KERNEL_DS);  /* es */
@@ -300,14 +366,37 @@ static void Setup_Kernel_Thread(
 
 
 /*
- * This is the body of the idle thread.  Its job is to preserve
- * the invariant that a runnable thread always exists,
- * i.e., the run queue is never empty.
+ * Release the kernel lock and halt the processor until an
+ * interrupt arrives.  sti only takes effect after the following
+ * instruction, so an interrupt can't slip in between it and
+ * the hlt and leave the processor asleep with work to do.
+ * Must be called with interrupts disabled!
+ */
+static void Halt_Until_Interrupt(void)
+{
+    Spin_Unlock(&g_kernelLock);
+    __asm__ __volatile__ ("sti; hlt; cli" : : : "memory");
+    Lock_Kernel();
+}
+
+/*
+ * This is the body of the idle threads, one per processor.
+ * An idle thread is never on a run queue: Get_Next_Runnable()
+ * falls back to the processor's idle thread when there is nothing
+ * to run here and nothing to take from the other processors.
+ * In between, the processor halts, without holding the kernel lock.
+ * Its timer wakes it every tick to look for work to steal, and
+ * a reschedule interrupt wakes it when a thread is put on its
+ * run queue.
  */
-static void Idle(ulong_t arg)
+static void __attribute__ ((noreturn)) Idle(ulong_t arg)
 {
-    while (true)
-	Yield();
+    Disable_Interrupts();
+    while (true) {
+	Schedule();
+	if (s_runQueue[Get_CPU()->id].numThreads == 0)
+	    Halt_Until_Interrupt();
+    }
 }
 
 /*
@@ -373,6 +462,248 @@ static __inline__ struct Kernel_Thread* Find_Best(struct Thread_Queue* queue)
     return best;
 }
 
+/*
+ * Add given thread to the back of the queue for its priority level.
+ */
+static __inline__ void Run_Queue_Add(struct Run_Queue* runQueue, struct Kernel_Thread* kthread)
+{
+    int priority = kthread->priority;
+
+    KASSERT(priority >= 0 && priority < NUM_PRIORITY_LEVELS);
+    Enqueue_Thread(&runQueue->level[priority], kthread);
+    runQueue->nonEmptyLevels |= (1UL << priority);
+    ++runQueue->numThreads;
+}
+
+static __inline__ void Run_Queue_Remove(struct Run_Queue* runQueue, struct Kernel_Thread* kthread)
+{
+    int priority = kthread->priority;
+
+    Remove_Thread(&runQueue->level[priority], kthread);
+    if (Is_Thread_Queue_Empty(&runQueue->level[priority]))
+	runQueue->nonEmptyLevels &= ~(1UL << priority);
+    --runQueue->numThreads;
+}
+
+/*
+ * Find the thread that has been waiting longest
+ * at the highest nonempty priority level.
+ * Returns null if the run queue is empty.
+ */
+static __inline__ struct Kernel_Thread* Run_Queue_Find_Best(struct Run_Queue* runQueue)
+{
+    ulong_t level;
+
+    if (runQueue->nonEmptyLevels == 0)
+	return 0;
+
+    __asm__ ("bsrl %1, %0" : "=r" (level) : "rm" (runQueue->nonEmptyLevels));
+    return Get_Front_Of_Thread_Queue(&runQueue->level[level]);
+}
+
+/*
+ * Does given thread belong to the fair-share scheduling class?
+ */
+static __inline__ bool Is_Fair_Thread(struct Kernel_Thread* kthread)
+{
+    return g_schedPolicy == SCHED_FAIR && kthread->priority != PRIORITY_IDLE;
+}
+
+/*
+ * Merge two skew heaps of threads ordered by vruntime.
+ * This is done top-down, without recursion, to keep
+ * stack usage bounded.
+ */
+static struct Kernel_Thread* Fair_Merge(struct Kernel_Thread* a, struct Kernel_Thread* b)
+{
+    struct Kernel_Thread *root, **link = &root;
+
+    while (a != 0 && b != 0) {
+	struct Kernel_Thread* next;
+
+	if (b->vruntime < a->vruntime) {
+	    next = a; a = b; b = next;
+	}
+
+	/* a goes here; merge its right subtree with b, into its left */
+	*link = a;
+	next = a->fairRight;
+	a->fairRight = a->fairLeft;
+	link = &a->fairLeft;
+	a = next;
+    }
+
+    *link = (a != 0) ? a : b;
+    return root;
+}
+
+static void Fair_Add(struct Run_Queue* runQueue, struct Kernel_Thread* kthread)
+{
+    kthread->fairLeft = kthread->fairRight = 0;
+    kthread->fairQueued = true;
+    runQueue->fairRoot = Fair_Merge(runQueue->fairRoot, kthread);
+    ++runQueue->numThreads;
+}
+
+static struct Kernel_Thread* Fair_Remove_Min(struct Run_Queue* runQueue)
+{
+    struct Kernel_Thread* min = runQueue->fairRoot;
+
+    KASSERT(min != 0);
+    runQueue->fairRoot = Fair_Merge(min->fairLeft, min->fairRight);
+    min->fairQueued = false;
+    --runQueue->numThreads;
+
+    if (min->vruntime > s_fairMinVruntime)
+	s_fairMinVruntime = min->vruntime;
+    return min;
+}
+
+/*
+ * Charge given thread (which must be the current thread)
+ * for the cycles it has run since it was last charged.
+ */
+static void Fair_Charge(struct Kernel_Thread* kthread)
+{
+    struct CPU* cpu = Get_CPU();
+    ulong_t now = Read_TSC();
+    unsigned long long scaled = (unsigned long long) (now - cpu->lastChargeTSC) * FAIR_WEIGHT_NORMAL;
+
+    cpu->lastChargeTSC = now;
+    kthread->vruntime += Divide_64((ulong_t) (scaled >> 32), (ulong_t) scaled,
+	s_fairWeight[kthread->priority]);
+}
+
+/*
+ * Find the thread that would run next from given run queue,
+ * without removing it.  Fair-share threads come first;
+ * the heap is always empty under SCHED_PRIORITY.
+ * Returns null if the run queue is empty.
+ */
+static struct Kernel_Thread* Run_Queue_Peek(struct Run_Queue* runQueue)
+{
+    if (runQueue->fairRoot != 0)
+	return runQueue->fairRoot;
+    return Run_Queue_Find_Best(runQueue);
+}
+
+/*
+ * Remove the thread that would run next from given run queue.
+ * Returns null if the run queue is empty.
+ */
+static struct Kernel_Thread* Run_Queue_Take(struct Run_Queue* runQueue)
+{
+    struct Kernel_Thread* kthread = Run_Queue_Peek(runQueue);
+
+    if (kthread == 0)
+	return 0;
+    if (kthread->fairQueued)
+	return Fair_Remove_Min(runQueue);
+    Run_Queue_Remove(runQueue, kthread);
+    return kthread;
+}
+
+/*
+ * May given thread run on given processor?
+ */
+static __inline__ bool Can_Run_On(struct Kernel_Thread* kthread, int cpu)
+{
+    return (kthread->affinity & (1UL << cpu)) != 0 && Get_CPU_By_Index(cpu)->online;
+}
+
+/*
+ * Is given processor running its idle thread, with nothing queued?
+ */
+static __inline__ bool Is_CPU_Idle(int cpu)
+{
+    struct CPU* c = Get_CPU_By_Index(cpu);
+
+    return c->currentThread == c->idleThread && s_runQueue[cpu].numThreads == 0;
+}
+
+/*
+ * Choose the processor whose run queue given thread goes on.
+ * A preempted or yielding thread stays where it is.  Otherwise
+ * the thread goes back to the processor it last ran on, where its
+ * cache is warm, unless that one is busy and another one is idle.
+ */
+static int Choose_CPU(struct Kernel_Thread* kthread)
+{
+    int self = Get_CPU()->id, last = kthread->cpu;
+    int i;
+
+    if (kthread == g_currentThread && Can_Run_On(kthread, self))
+	return self;
+
+    if (Can_Run_On(kthread, last) && Is_CPU_Idle(last))
+	return last;
+    for (i = 0; i < Get_Num_CPUs(); ++i) {
+	if (Can_Run_On(kthread, i) && Is_CPU_Idle(i))
+	    return i;
+    }
+
+    if (Can_Run_On(kthread, last))
+	return last;
+    for (i = 0; i < Get_Num_CPUs(); ++i) {
+	if (Can_Run_On(kthread, i))
+	    return i;
+    }
+
+    /* Set_Affinity() doesn't allow a mask without an online processor */
+    KASSERT(false);
+    return self;
+}
+
+/*
+ * A thread was put on the run queue of another processor.
+ * Interrupt that processor, so it picks a new thread, if it is
+ * idle or the new thread outranks the one it's running.
+ * Fair-share threads wait for the next tick instead.
+ */
+static void Reschedule_CPU(int cpu, struct Kernel_Thread* kthread)
+{
+    struct CPU* c = Get_CPU_By_Index(cpu);
+
+    if (c->currentThread == c->idleThread ||
+	(!Is_Fair_Thread(kthread) && kthread->priority > c->currentThread->priority)) {
+	++g_numReschedIPIs;
+	Send_IPI(c->apicId, IPI_FIXED | RESCHEDULE_VECTOR);
+    }
+}
+
+/*
+ * Take a thread from another processor's run queue, for given
+ * processor, which has nothing to run.  The thread that would run
+ * next on the processor with the most threads queued is taken,
+ * if it is allowed to run here.  Returns null if there's
+ * nothing to take.
+ */
+static struct Kernel_Thread* Steal_Thread(int self)
+{
+    struct Run_Queue* victim = 0;
+    struct Kernel_Thread* kthread;
+    int i;
+
+    for (i = 0; i < Get_Num_CPUs(); ++i) {
+	struct Run_Queue* runQueue = &s_runQueue[i];
+
+	if (i == self || runQueue->numThreads == 0)
+	    continue;
+	if (victim != 0 && runQueue->numThreads <= victim->numThreads)
+	    continue;
+	if (Can_Run_On(Run_Queue_Peek(runQueue), self))
+	    victim = runQueue;
+    }
+
+    if (victim == 0)
+	return 0;
+
+    kthread = Run_Queue_Take(victim);
+    ++g_numThreadsStolen;
+    TRACE(TRACE_STEAL, kthread->pid, victim - s_runQueue);
+    return kthread;
+}
+
 /*
  * Acquires pointer to thread-local data from the current thread
  * indexed by the given key.  Assumes interrupts are off.
@@ -426,6 +757,7 @@ static void Tlocal_Exit(struct Kernel_Thread* curr) {
 void Init_Scheduler(void)
 {
     struct Kernel_Thread* mainThread = (struct Kernel_Thread *) KERN_THREAD_OBJ;
+    struct Kernel_Thread* idleThread;
 
     /*
      * Create initial kernel thread context object and stack,
@@ -436,10 +768,14 @@ void Init_Scheduler(void)
     Add_To_Back_Of_All_Thread_List(&s_allThreadList, mainThread);
 
     /*
-     * Create the idle thread.
+     * Create the boot processor's idle thread.
+     * It isn't made runnable: see Idle().
      */
     /*Print("starting idle thread\n");*/
-    Start_Kernel_Thread(Idle, 0, PRIORITY_IDLE, true);
+    idleThread = Create_Idle_Thread();
+    KASSERT(idleThread != 0);
+    Setup_Kernel_Thread(idleThread, Idle, 0);
+    Get_CPU()->idleThread = idleThread;
 
     /*
      * Create the reaper thread.
@@ -483,14 +819,42 @@ struct Kernel_Thread* Start_Kernel_Thread(
 }
 
 /*
- * Add given thread to the run queue, so that it
- * may be scheduled.  Must be called with interrupts disabled!
+ * Add given thread to a run queue, so that it
+ * may be scheduled.  The processor is chosen by Choose_CPU();
+ * if it's another one, it is interrupted when it should pick
+ * the thread right away.
+ * Must be called with interrupts disabled!
  */
 void Make_Runnable(struct Kernel_Thread* kthread)
 {
+    struct Run_Queue* runQueue;
+    int cpu;
+
     KASSERT(!Interrupts_Enabled());
 
-    Enqueue_Thread(&s_runQueue, kthread);
+    /* Idle threads are run only when there's nothing else to run */
+    if (kthread == Get_CPU()->idleThread)
+	return;
+
+    cpu = Choose_CPU(kthread);
+    runQueue = &s_runQueue[cpu];
+    kthread->cpu = cpu;
+
+    if (!Is_Fair_Thread(kthread)) {
+	Run_Queue_Add(runQueue, kthread);
+    } else {
+	if (kthread == g_currentThread) {
+	    /* Preempted or yielding: charge it before it's queued by vruntime */
+	    Fair_Charge(kthread);
+	} else if (kthread->vruntime + FAIR_SLEEPER_CREDIT < s_fairMinVruntime) {
+	    /* Woken up after a long sleep */
+	    kthread->vruntime = s_fairMinVruntime - FAIR_SLEEPER_CREDIT;
+	}
+	Fair_Add(runQueue, kthread);
+    }
+
+    if (cpu != Get_CPU()->id)
+	Reschedule_CPU(cpu, kthread);
 }
 
 /*
@@ -504,6 +868,34 @@ void Make_Runnable_Atomic(struct Kernel_Thread* kthread)
     Enable_Interrupts();
 }
 
+/*
+ * Change the effective priority of given thread, which may
+ * be runnable, waiting, or the current thread.  Its base
+ * priority is unaffected.  Used for priority inheritance.
+ * Must be called with interrupts disabled!
+ */
+void Set_Effective_Priority(struct Kernel_Thread* kthread, int priority)
+{
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(priority >= 0 && priority < NUM_PRIORITY_LEVELS);
+
+    /*
+     * A runnable thread has to move to the queue for its new
+     * priority level.  Wait queues are searched for the best
+     * thread when one is woken, so nothing needs to be moved there.
+     * Under the fair scheduler, priority only changes the rate at
+     * which vruntime advances, so a thread in the fair heap stays put.
+     */
+    KASSERT(!kthread->fairQueued || priority != PRIORITY_IDLE);
+    if (Is_Member_Of_Thread_Queue(&s_runQueue[kthread->cpu].level[kthread->priority], kthread)) {
+	Run_Queue_Remove(&s_runQueue[kthread->cpu], kthread);
+	kthread->priority = priority;
+	Make_Runnable(kthread);
+    } else {
+	kthread->priority = priority;
+    }
+}
+
 /*
  * Get the thread that currently has the CPU.
  */
@@ -513,16 +905,131 @@ struct Kernel_Thread* Get_Current(void)
 }
 
 /*
- * Get the next runnable thread from the run queue.
+ * Is given thread the current thread of some processor?
+ * Must be called with interrupts disabled!
+ */
+bool Is_Thread_Running(struct Kernel_Thread* kthread)
+{
+    int i;
+
+    KASSERT(!Interrupts_Enabled());
+
+    for (i = 0; i < Get_Num_CPUs(); ++i) {
+	if (Get_CPU_By_Index(i)->currentThread == kthread)
+	    return true;
+    }
+    return false;
+}
+
+/*
+ * Restrict given thread to the processors in given mask
+ * (bit n for processor n; ALL_CPUS lets it run anywhere).
+ * If it is running or queued on a processor it may no longer
+ * use, it moves at its next scheduling decision; the current
+ * thread moves right away.  Returns 0 if successful, or
+ * EINVALID if none of the processors in the mask is online.
+ * Interrupts must be enabled.
+ */
+int Set_Affinity(struct Kernel_Thread* kthread, ulong_t affinity)
+{
+    int i;
+
+    KASSERT(Interrupts_Enabled());
+
+    Disable_Interrupts();
+
+    for (i = 0; i < Get_Num_CPUs(); ++i) {
+	if ((affinity & (1UL << i)) != 0 && Get_CPU_By_Index(i)->online)
+	    break;
+    }
+    if (i == Get_Num_CPUs()) {
+	Enable_Interrupts();
+	return EINVALID;
+    }
+
+    kthread->affinity = affinity;
+
+    if (kthread == g_currentThread && !Can_Run_On(kthread, Get_CPU()->id)) {
+	Make_Runnable(kthread);
+	Schedule();
+    } else if (Is_Thread_Running(kthread) && !Can_Run_On(kthread, kthread->cpu)) {
+	++g_numReschedIPIs;
+	Send_IPI(Get_CPU_By_Index(kthread->cpu)->apicId, IPI_FIXED | RESCHEDULE_VECTOR);
+    }
+
+    Enable_Interrupts();
+    return 0;
+}
+
+/*
+ * Would given thread run before the current thread gets
+ * the CPU back, if the current thread yielded now?
+ * Always false if the thread isn't runnable, or is queued
+ * on another processor.
+ * Must be called with interrupts disabled!
+ */
+bool Runs_Ahead_Of_Current(struct Kernel_Thread* kthread)
+{
+    KASSERT(!Interrupts_Enabled());
+
+    if (kthread->cpu != Get_CPU()->id)
+	return false;
+
+    if (kthread->fairQueued) {
+	/* Fair threads run before idle ones; among them, least vruntime first */
+	if (!Is_Fair_Thread(g_currentThread))
+	    return true;
+	Fair_Charge(g_currentThread);
+	return kthread->vruntime <= g_currentThread->vruntime;
+    }
+
+    if (!Is_Member_Of_Thread_Queue(&s_runQueue[kthread->cpu].level[kthread->priority], kthread))
+	return false;
+
+    /* On the run queue: a yield puts us behind it only at its level or below */
+    return !Is_Fair_Thread(g_currentThread) && kthread->priority >= g_currentThread->priority;
+}
+
+/*
+ * Get the next runnable thread from this processor's run queue,
+ * or failing that, from another processor's.
  * This is the scheduler.
  */
 struct Kernel_Thread* Get_Next_Runnable(void)
 {
-    struct Kernel_Thread* best = 0;
+    struct CPU* cpu = Get_CPU();
+    struct Run_Queue* runQueue = &s_runQueue[cpu->id];
+    struct Kernel_Thread* best;
 
-    best = Find_Best(&s_runQueue);
-    KASSERT(best != 0);
-    Remove_Thread(&s_runQueue, best);
+    if (g_schedPolicy == SCHED_FAIR) {
+	/* A thread that is blocking or exiting hasn't been charged yet */
+	if (Is_Fair_Thread(g_currentThread) && !g_currentThread->fairQueued)
+	    Fair_Charge(g_currentThread);
+	else
+	    cpu->lastChargeTSC = Read_TSC();
+    }
+
+    /*
+     * A thread whose affinity changed while it was queued
+     * is moved to a processor it may run on.
+     */
+    while ((best = Run_Queue_Take(runQueue)) != 0 && !Can_Run_On(best, cpu->id))
+	Make_Runnable(best);
+
+    /* With nothing else to run, the processor runs its idle thread. */
+    if (best == 0)
+	best = Steal_Thread(cpu->id);
+    if (best == 0) {
+	best = cpu->idleThread;
+	KASSERT(best != 0);
+    }
+    best->cpu = cpu->id;
+
+    if (best != g_currentThread) {
+	Perf_Charge(g_currentThread);
+	++g_numContextSwitches;
+	TRACE(TRACE_SWITCH, g_currentThread->pid, best->pid);
+    }
 
 /*
  *    Print("Scheduling %x\n", best);
@@ -548,6 +1055,8 @@ void Schedule(void)
     /* Preemption should not be disabled. */
     KASSERT(!g_preemptionDisabled);
 
+    TRACE(TRACE_SCHEDULE, g_currentThread->pid, 0);
+
     /* Get next thread to run from the run queue */
     runnable = Get_Next_Runnable();
 
@@ -639,6 +1148,38 @@ int Join(struct Kernel_Thread* kthread)
     return exitCode;
 }
 
+/*
+ * Create the thread object and stack for an idle thread.
+ * An application processor starts out running on the stack
+ * (see Start_APs()), and later becomes the thread by calling
+ * Start_AP_Scheduler(); the boot processor's idle thread
+ * is created by Init_Scheduler().
+ */
+struct Kernel_Thread* Create_Idle_Thread(void)
+{
+    return Create_Thread(PRIORITY_IDLE, true);
+}
+
+/*
+ * Start scheduling threads on an application processor.
+ * The processor is running on its idle thread's stack,
+ * with interrupts disabled; it becomes the idle thread.
+ */
+void Start_AP_Scheduler(void)
+{
+    struct CPU* cpu = Get_CPU();
+
+    KASSERT(!Interrupts_Enabled());
+    KASSERT(cpu->idleThread != 0);
+
+    cpu->idleThread->cpu = cpu->id;
+    cpu->currentThread = cpu->idleThread;
+    cpu->lastChargeTSC = Read_TSC();
+    Enable_Interrupts();
+
+    Idle(0);
+}
+
 /*
  * Look up a thread by its process id.
  * The caller must be the thread's owner.
@@ -694,11 +1235,73 @@ void Wait(struct Thread_Queue* waitQueue)
     Schedule();
 }
 
+/*
+ * Like Wait(), but give up after given number of timer ticks.
+ * Returns true if the thread was woken up, or false if the
+ * timeout expired first.
+ * Must be called with interrupts disabled!
+ */
+bool Wait_Timeout(struct Thread_Queue* waitQueue, ulong_t ticks)
+{
+    struct Kernel_Thread* current = g_currentThread;
+
+    KASSERT(!Interrupts_Enabled());
+
+    current->wakeupTick = g_numTicks + ticks;
+    current->timeoutQueue = waitQueue;
+    current->timedOut = false;
+    Add_To_Back_Of_Timeout_List(&s_timeoutList, current);
+
+    Wait(waitQueue);
+
+    /*
+     * Only Wake_Expired_Timeouts() sets timedOut, and only when it
+     * is the one to wake us.  Being off the timeout list doesn't
+     * mean that: it also takes threads off once their deadline has
+     * passed, even if they were woken normally before then.
+     */
+    if (Is_Member_Of_Timeout_List(&s_timeoutList, current))
+	Remove_From_Timeout_List(&s_timeoutList, current);
+    current->timeoutQueue = 0;
+
+    return !current->timedOut;
+}
+
+/*
+ * Wake up threads whose Wait_Timeout() has expired.
+ * Called from the timer interrupt handler.
+ */
+void Wake_Expired_Timeouts(void)
+{
+    struct Kernel_Thread *kthread, *next;
+
+    KASSERT(!Interrupts_Enabled());
+
+    for (kthread = Get_Front_Of_Timeout_List(&s_timeoutList); kthread != 0; kthread = next) {
+	next = Get_Next_In_Timeout_List(kthread);
+
+	if ((long) (g_numTicks - kthread->wakeupTick) < 0)
+	    continue;
+
+	Remove_From_Timeout_List(&s_timeoutList, kthread);
+
+	/*
+	 * If it's no longer in the wait queue, it was woken up
+	 * normally and just hasn't run yet.
+	 */
+	if (Is_Member_Of_Thread_Queue(kthread->timeoutQueue, kthread)) {
+	    Remove_Thread(kthread->timeoutQueue, kthread);
+	    kthread->timedOut = true;
+	    Make_Runnable(kthread);
+	    if (kthread->cpu == Get_CPU()->id && kthread->priority > g_currentThread->priority)
+		g_needReschedule = true;
+	}
+    }
+}
+
 /*
  * Wake up all threads waiting on given wait queue.
  * Must be called with interrupts disabled!
- * See Keyboard_Interrupt_Handler() function in keyboard.c
- * for an example.
  */
 void Wake_Up(struct Thread_Queue* waitQueue)
 {
@@ -712,6 +1315,7 @@ void Wake_Up(struct Thread_Queue* waitQueue)
      */
     while (kthread != 0) {
 	next = Get_Next_In_Thread_Queue(kthread);
+	TRACE(TRACE_WAKE_UP, kthread->pid, waitQueue);
 	Make_Runnable(kthread);
 	kthread = next;
     }
@@ -723,9 +1327,12 @@ void Wake_Up(struct Thread_Queue* waitQueue)
 /*
  * Wake up a single thread waiting on given wait queue
  * (if there are any threads waiting).  Chooses the highest priority thread.
+ * Returns the thread that was woken, or null if the queue was empty.
  * Interrupts must be disabled!
+ * See Wake_Key_Consumer() function in keyboard.c
+ * for an example.
  */
-void Wake_Up_One(struct Thread_Queue* waitQueue)
+struct Kernel_Thread* Wake_Up_One(struct Thread_Queue* waitQueue)
 {
     struct Kernel_Thread* best;
 
@@ -735,9 +1342,12 @@ void Wake_Up_One(struct Thread_Queue* waitQueue)
 
     if (best != 0) {
 	Remove_Thread(waitQueue, best);
+	TRACE(TRACE_WAKE_UP, best->pid, waitQueue);
 	Make_Runnable(best);
 	/*Print("Wake_Up_One: waking up %x from %x\n", best, g_currentThread); */
     }
+
+    return best;
 }
 
 /*
@@ -811,3 +1421,63 @@ void Dump_All_Thread_List(void)
 
     End_Int_Atomic(iflag);
 }
+
+/*
+ * Print the scheduler's counters, the length of each
+ * processor's run queue, and how much each processor has
+ * waited for the kernel lock.
+ */
+void Dump_Scheduler_Stats(void)
+{
+    bool iflag;
+    int i;
+
+    Print("%lu context switches, %lu threads stolen, %lu reschedule IPIs\n",
+	g_numContextSwitches, g_numThreadsStolen, g_numReschedIPIs);
+
+    iflag = Begin_Int_Atomic();
+    for (i = 0; i < Get_Num_CPUs(); ++i) {
+	struct CPU* cpu = Get_CPU_By_Index(i);
+
+	Print("cpu %d: %d runnable, waited %lu times for the kernel lock, %lu Kcycles\n",
+	    i, s_runQueue[i].numThreads, cpu->kernelLockWaits,
+	    Perf_Ratio(cpu->kernelLockWaitCycles, 1000, 1));
+    }
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Print the hardware event counts of all threads.
+ * Counts are in thousands.
+ */
+void Dump_Thread_Perf_Counts(void)
+{
+    struct Kernel_Thread *kthread;
+    bool iflag;
+    int i;
+
+    if (!Perf_Counters_Present()) {
+	Print("No performance counters\n");
+	return;
+    }
+
+    Print("%5s", "pid");
+    for (i = 0; i < NUM_PERF_EVENTS; ++i)
+	Print(" %13s", Get_Perf_Event_Name(i));
+    Print(" %6s\n", "IPC");
+
+    iflag = Begin_Int_Atomic();
+    for (kthread = Get_Front_Of_All_Thread_List(&s_allThreadList); kthread != 0;
+	 kthread = Get_Next_In_All_Thread_List(kthread)) {
+	struct Perf_Counts counts;
+	ulong_t ipc;
+
+	Get_Thread_Perf_Counts(kthread, &counts);
+	Print("%5d", kthread->pid);
+	for (i = 0; i < NUM_PERF_EVENTS; ++i)
+	    Print(" %12luK", Perf_Ratio(counts.count[i], 1000, 1));
+	ipc = Perf_Ratio(counts.count[PERF_INSTRUCTIONS], counts.count[PERF_CYCLES], 100);
+	Print(" %3lu.%02lu\n", ipc / 100, ipc % 100);
+    }
+    End_Int_Atomic(iflag);
+}
@@ -23,6 +23,26 @@
 ; This is the size of the Interrupt_State struct in int.h
 INTERRUPT_STATE_SIZE equ 64
 
+; Size and field offsets of the Interrupt_Stats struct in int.h
+INTERRUPT_STATS_SIZE equ 20
+STATS_COUNT equ 0
+STATS_TOTAL_LOW equ 4
+STATS_TOTAL_HIGH equ 8
+STATS_MAX equ 12
+STATS_RESCHEDULES equ 16
+
+; Offsets of the saved fs and eflags in the Interrupt_State struct,
+; and the interrupt flag in eflags
+STATE_FS equ 4
+STATE_EFLAGS equ 60
+EFLAGS_IF equ (1 << 9)
+
+; Field offsets of the per-CPU data (struct CPU in smp.h),
+; which the fs segment register selects
+CPU_CURRENT_THREAD equ 4
+CPU_NEED_RESCHEDULE equ 8
+CPU_PREEMPTION_DISABLED equ 12
+
 ; Save registers prior to calling a handler function.
 ; This must be kept up to date with:
 ;   - Interrupt_State struct in int.h
@@ -64,12 +84,43 @@ INTERRUPT_STATE_SIZE equ 64
 ; registers have been saved.
 REG_SKIP equ (11*4)
 
+; Take the kernel lock on entry to an interrupt, unless the
+; interrupted code already held it (had interrupts disabled).
+; If another processor holds it, Lock_Kernel_Contended waits
+; for it and counts the wait.
+; Registers have been saved; clobbers eax, ecx and edx.
+%macro Lock_Kernel_On_Entry 0
+	test	dword [esp+STATE_EFLAGS], EFLAGS_IF
+	jz	%%done
+	mov	eax, 1
+	xchg	eax, [g_kernelLock]
+	test	eax, eax
+	jz	%%done
+	call	Lock_Kernel_Contended
+%%done:
+%endmacro
+
+; Prepare to restore the thread whose saved registers are on the
+; stack.  The thread may have last run on another processor, so it
+; gets this processor's per-CPU segment.  If it's returning to code
+; with interrupts enabled, release the kernel lock; otherwise the
+; thread inherits it.
+%macro Unlock_Kernel_On_Return 0
+	mov	[esp+STATE_FS], fs
+	test	dword [esp+STATE_EFLAGS], EFLAGS_IF
+	jz	%%done
+	mov	dword [g_kernelLock], 0
+%%done:
+%endmacro
+
 ; Template for entry point code for interrupts that have
 ; an explicit processor-generated error code.
-; The argument is the interrupt number.
+; The argument is the interrupt number.  STRICT keeps nasm's
+; optimizer from shortening the pushes, so that every entry
+; point has the same size (see g_handlerSizeErr).
 %macro Int_With_Err 1
 align 8
-	push	dword %1	; push interrupt number
+	push	strict dword %1	; push interrupt number
 	jmp	Handle_Interrupt ; jump to common handler
 %endmacro
 
@@ -79,8 +130,8 @@ align 8
 ; for all interrupts.
 %macro Int_No_Err 1
 align 8
-	push	dword 0		; fake error code
-	push	dword %1	; push interrupt number
+	push	strict dword 0	; fake error code
+	push	strict dword %1	; push interrupt number
 	jmp	Handle_Interrupt ; jump to common handler
 %endmacro
 
@@ -93,15 +144,19 @@ align 8
 ; of C handler functions for interrupts.
 IMPORT g_interruptTable
 
-; Global variable pointing to context struct for current thread.
-IMPORT g_currentThread
+; Per-interrupt handler cost accounting, defined in int.c.
+IMPORT g_interruptStats
+
+; The kernel lock, defined in int.c.  The current thread, and the
+; flags saying that we need to choose a new thread in the interrupt
+; return code, and that preemption is disabled, are per-CPU data.
+IMPORT g_kernelLock
 
-; Set to non-zero when we need to choose a new thread
-; in the interrupt return code.
-IMPORT g_needReschedule
+; Waits for the kernel lock when another processor has it, defined in int.c.
+IMPORT Lock_Kernel_Contended
 
-; Set to non-zero when preemption is disabled.
-IMPORT g_preemptionDisabled
+; Runs deferred interrupt work (tasklets), defined in tasklet.c.
+IMPORT Run_Tasklets
 
 ; This is the function that returns the next runnable thread.
 IMPORT Get_Next_Runnable
@@ -187,12 +242,21 @@ Handle_Interrupt:
 	mov	ds, ax
 	mov	es, ax
 
+	; Exclude the other processors
+	Lock_Kernel_On_Entry
+
 	; Get the address of the C handler function from the
 	; table of handler functions.
 	mov	eax, g_interruptTable	; get address of handler table
 	mov	esi, [esp+REG_SKIP]	; get interrupt number
 	mov	ebx, [eax+esi*4]	; get address of handler function
 
+	; Read the time stamp counter, so we can tell how many
+	; cycles the handler takes.  The low 32 bits are kept in edi,
+	; which the handler must preserve (as must esi).
+	rdtsc
+	mov	edi, eax
+
 	; Call the handler.
 	; The argument passed is a pointer to an Interrupt_State struct,
 	; which describes the stack layout for all interrupts.
@@ -200,36 +264,64 @@ Handle_Interrupt:
 	call	ebx
 	add	esp, 4			; clear 1 argument
 
+	; Account for the cycles spent in the handler.
+	; Afterwards, edi points to the Interrupt_Stats for this interrupt.
+	rdtsc
+	sub	eax, edi		; eax = cycles spent in handler
+	imul	edi, esi, INTERRUPT_STATS_SIZE
+	add	edi, g_interruptStats
+	inc	dword [edi+STATS_COUNT]
+	add	[edi+STATS_TOTAL_LOW], eax
+	adc	dword [edi+STATS_TOTAL_HIGH], 0
+	cmp	eax, [edi+STATS_MAX]
+	jbe	.notMax
+	mov	[edi+STATS_MAX], eax
+.notMax:
+
+	; Run any tasklets (bottom halves) the handler scheduled.
+	; They run with interrupts enabled, so they are not
+	; charged to the handler.  Run_Tasklets preserves
+	; esi and edi, like any C function.
+	push	esp
+	call	Run_Tasklets
+	add	esp, 4			; clear 1 argument
+
 	; If preemption is disabled, then the current thread
 	; keeps running.
-	cmp	[g_preemptionDisabled], dword 0
+	cmp	[fs:CPU_PREEMPTION_DISABLED], dword 0
 	jne	.restore
 
 	; See if we need to choose a new thread to run.
-	cmp	[g_needReschedule], dword 0
+	cmp	[fs:CPU_NEED_RESCHEDULE], dword 0
 	je	.restore
 
+	; Charge the reschedule to this interrupt.
+	inc	dword [edi+STATS_RESCHEDULES]
+
 	; Put current thread back on the run queue
-	push	dword [g_currentThread]
+	push	dword [fs:CPU_CURRENT_THREAD]
 	call	Make_Runnable
 	add	esp, 4			; clear 1 argument
 
 	; Save stack pointer in current thread context, and
 	; clear numTicks field.
-	mov	eax, [g_currentThread]
+	mov	eax, [fs:CPU_CURRENT_THREAD]
 	mov	[eax+0], esp		; esp field
 	mov	[eax+4], dword 0	; numTicks field
 
 	; Pick a new thread to run, and switch to its stack
 	call	Get_Next_Runnable
-	mov	[g_currentThread], eax
+	mov	[fs:CPU_CURRENT_THREAD], eax
 	mov	esp, [eax+0]		; esp field
 
 	; Clear "need reschedule" flag
-	mov	[g_needReschedule], dword 0
+	mov	[fs:CPU_NEED_RESCHEDULE], dword 0
 
 .restore:
 
+	; Let the other processors in, if we're done with the lock
+	Unlock_Kernel_On_Return
+
 	; Restore registers
 	Restore_Registers
 
@@ -245,7 +337,7 @@ Handle_Interrupt:
 ;   - ptr to Kernel_Thread whose state should be restored and made active
 ;
 ; Notes:
-; Called with interrupts disabled.
+; Called with interrupts disabled, holding the kernel lock.
 ; This must be kept up to date with definition of Kernel_Thread
 ; struct, in kthread.h.
 ; ----------------------------------------------------------------------
@@ -281,7 +373,7 @@ Switch_To_Thread:
 	Save_Registers
 
 	; Save stack pointer in the thread context struct (at offset 0).
-	mov	eax, [g_currentThread]
+	mov	eax, [fs:CPU_CURRENT_THREAD]
 	mov	[eax+0], esp
 
 	; Clear numTicks field in thread context, since this
@@ -294,9 +386,12 @@ Switch_To_Thread:
 	mov	eax, [esp+INTERRUPT_STATE_SIZE]
 
 	; Make the new thread current, and switch to its stack.
-	mov	[g_currentThread], eax
+	mov	[fs:CPU_CURRENT_THREAD], eax
 	mov	esp, [eax+0]
 
+	; Release the kernel lock if the new thread runs with
+	; interrupts enabled
+	Unlock_Kernel_On_Return
 
 	; Restore general purpose and segment registers, and clear interrupt
 	; number and error code.
@@ -15,12 +15,20 @@
 #include <geekos/screen.h>
 #include <geekos/mem.h>
 #include <geekos/crc32.h>
+#include <geekos/smp.h>
 #include <geekos/tss.h>
 #include <geekos/int.h>
 #include <geekos/kthread.h>
 #include <geekos/trap.h>
 #include <geekos/timer.h>
 #include <geekos/keyboard.h>
+#include <geekos/serial.h>
+#include <geekos/trace.h>
+#include <geekos/profile.h>
+#include <geekos/perfctr.h>
+#include <geekos/synch.h>
+#include <geekos/workqueue.h>
+#include <geekos/bench.h>
 
 ////////////////////////////////////////////////
 // Declarations ////////////////////////////////
@@ -66,6 +74,7 @@ bool isKernelThreadValid = true;
 // Function Prototypes
 
 void Kernel_Thread(void * args);
+void Bench_Thread(ulong_t arg);
 
 void Display();
 
@@ -106,14 +115,31 @@ void Main(struct Boot_Info* bootInfo)
     Init_Screen();
     Init_Mem(bootInfo);
     Init_CRC32();
+    Init_SMP();
+    Init_Perf_Counters();
     Init_TSS();
     Init_Interrupts();
+    Init_Serial();
+
+    if (bootInfo->bootInfoSize >= (int) sizeof(struct Boot_Info))
+	Print("Kernel loaded in %d ms\n", bootInfo->loadTicks * 10000 / 182);
+
     Init_Scheduler();
     Init_Traps();
     Init_Timer();
+
+    if (bootInfo->bootInfoSize >= (int) sizeof(struct Boot_Info) &&
+	bootInfo->decompressCycles != 0)
+	Print("Kernel decompressed in %lu us\n", Cycles_To_Us(bootInfo->decompressCycles));
     Init_Keyboard();
+    Init_Work_Queues();
+    Start_APs();
     
+#ifdef BENCH_MODE
+    Start_Kernel_Thread(Bench_Thread, 0, PRIORITY_NORMAL, true);
+#else
     Start_Kernel_Thread(Kernel_Thread, 0, PRIORITY_NORMAL, true);
+#endif
     
     Exit(0);
 }
@@ -122,6 +148,16 @@ void Main(struct Boot_Info* bootInfo)
 // Implementations /////////////////////////////
 ////////////////////////////////////////////////
 
+/*
+ * Benchmark build (make bench.img): run the benchmark
+ * suite instead of the editor, then leave the emulator.
+ */
+void Bench_Thread(ulong_t arg) {
+    
+    Init_Kernel_Benchmarks();
+    Exit_Emulator(Run_Benchmarks());
+}
+
 void Kernel_Thread(void * args) {
     
     int i;
@@ -146,7 +182,7 @@ void Kernel_Thread(void * args) {
         type = COMMAND_NO_OPERATION;
         keyCode = Get_From_Keyboard(&type);
         
-        if(keyCode == NULL) {
+        if(keyCode == 0) {
          
             switch (type) {
                     
@@ -160,10 +196,11 @@ void Kernel_Thread(void * args) {
                 case COMMAND_PAGE_UP:       PgUp();         break;
                 case COMMAND_PAGE_DOWN:     PgDn();         break;
                 case COMMAND_CTRL_D:        Close();        break;
-                case COMMAND_F1:                            break;
-                case COMMAND_F2:                            break;
-                case COMMAND_F3:                            break;
-                case COMMAND_F4:                            break;
+                case COMMAND_CTRL_P:        Dump_Thread_Perf_Counts(); break;
+                case COMMAND_F1:            Dump_Keyboard_Stats(); break;
+                case COMMAND_F2:            Dump_Interrupt_Stats(); break;
+                case COMMAND_F3:            Dump_Lock_Stats(); Dump_Scheduler_Stats(); break;
+                case COMMAND_F4:            Dump_Trace();   break;
                 case COMMAND_F5:            Save(0);        break;
                 case COMMAND_F6:            Load(0);        break;
                 case COMMAND_F7:            Save(1);        break;
@@ -174,13 +211,16 @@ void Kernel_Thread(void * args) {
                 case COMMAND_F12:           Load(3);        break;
                 case COMMAND_DELETE:        GetDelete();    break;
                 case COMMAND_BACKSPACE:     GetBackspace(); break;
+                case COMMAND_SCROLL_LOCK:   Dump_Profile(); break;
                     
             }
             
+            Record_Key_Latency();
             continue;
         }
         
         Buffer(keyCode);
+        Record_Key_Latency();
     }
 }
 
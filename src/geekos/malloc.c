@@ -12,6 +12,7 @@
 #include <geekos/bget.h>
 #include <geekos/kassert.h>
 #include <geekos/malloc.h>
+#include <geekos/trace.h>
 
 /*
  * Initialize the heap starting at given address and occupying
@@ -39,6 +40,8 @@ void* Malloc(ulong_t size)
     result = bget(size);
     End_Int_Atomic(iflag);
 
+    TRACE(TRACE_MALLOC, size, result);
+
     return result;
 }
 
@@ -49,6 +52,8 @@ void Free(void* buf)
 {
     bool iflag;
 
+    TRACE(TRACE_FREE, buf, 0);
+
     iflag = Begin_Int_Atomic();
     brel(buf);
     End_Int_Atomic(iflag);
@@ -0,0 +1,271 @@
+/*
+ * Hardware performance counters
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/screen.h>
+#include <geekos/int.h>
+#include <geekos/cpu.h>
+#include <geekos/kthread.h>
+#include <geekos/smp.h>
+#include <geekos/perfctr.h>
+
+/*
+ * We use the architectural performance monitoring facility
+ * described by cpuid leaf 0xa: each event gets a general purpose
+ * counter, programmed through its event select MSR to count in
+ * both user and kernel mode, and read with rdpmc.  The counters
+ * are never stopped or reset; a thread is charged for the
+ * difference between readings taken when it gets and gives up
+ * the CPU.  Each processor has its own counters, programmed the
+ * same way.  Processors without the facility (including QEMU
+ * without KVM) simply report no counters.
+ */
+
+/* ----------------------------------------------------------------------
+ * Private data and functions
+ * ---------------------------------------------------------------------- */
+
+#define CPUID_LEAF_PERFMON 0x0a
+
+#define MSR_PMC0		0x0c1
+#define MSR_PERFEVTSEL0		0x186
+#define MSR_PERF_GLOBAL_CTRL	0x38f
+
+#define PERFEVTSEL_USR  (1 << 16)
+#define PERFEVTSEL_OS   (1 << 17)
+#define PERFEVTSEL_EN   (1 << 22)
+
+/*
+ * Event select and unit mask for each event, and the bit in
+ * ebx of cpuid leaf 0xa that is set if the event is unavailable.
+ */
+struct Perf_Event_Info {
+    const char* name;
+    uchar_t eventSelect;
+    uchar_t unitMask;
+    int unavailableBit;
+};
+
+static const struct Perf_Event_Info s_eventInfo[NUM_PERF_EVENTS] = {
+    { "cycles",       0x3c, 0x00, 0 },
+    { "instructions", 0xc0, 0x00, 1 },
+    { "llc-misses",   0x2e, 0x41, 4 },
+    { "br-misses",    0xc5, 0x00, 6 },
+};
+
+/*
+ * Counter used for each event, or -1 if not counted.
+ */
+static int s_counterFor[NUM_PERF_EVENTS] = { -1, -1, -1, -1 };
+
+static int s_pmuVersion;
+static int s_numCounters;
+static unsigned long long s_counterMask;
+
+/*
+ * Counter values when each processor's current thread was last charged.
+ */
+static unsigned long long s_lastRead[MAX_CPUS][NUM_PERF_EVENTS];
+
+static void Read_Counters(unsigned long long* values)
+{
+    int i;
+
+    for (i = 0; i < NUM_PERF_EVENTS; ++i) {
+	if (s_counterFor[i] >= 0)
+	    values[i] = Read_PMC(s_counterFor[i]) & s_counterMask;
+	else
+	    values[i] = 0;
+    }
+}
+
+/*
+ * Add the events counted since the last charge to given counts.
+ * Interrupts must be disabled.
+ */
+static void Add_Pending_Counts(struct Perf_Counts* counts, bool consume)
+{
+    unsigned long long now[NUM_PERF_EVENTS];
+    unsigned long long* lastRead = s_lastRead[Get_CPU()->id];
+    int i;
+
+    Read_Counters(now);
+    for (i = 0; i < NUM_PERF_EVENTS; ++i) {
+	counts->count[i] += (now[i] - lastRead[i]) & s_counterMask;
+	if (consume)
+	    lastRead[i] = now[i];
+    }
+}
+
+/*
+ * Program this processor's counters for the events
+ * chosen by Init_Perf_Counters().
+ */
+static void Program_Counters(void)
+{
+    int i, numUsed = 0;
+
+    for (i = 0; i < NUM_PERF_EVENTS; ++i) {
+	const struct Perf_Event_Info* info = &s_eventInfo[i];
+	int counter = s_counterFor[i];
+
+	if (counter < 0)
+	    continue;
+
+	Write_MSR(MSR_PERFEVTSEL0 + counter, 0);
+	Write_MSR(MSR_PMC0 + counter, 0);
+	Write_MSR(MSR_PERFEVTSEL0 + counter,
+	    info->eventSelect | (info->unitMask << 8) |
+	    PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_EN);
+	++numUsed;
+    }
+
+    /* Version 2 added a global enable for the counters */
+    if (s_pmuVersion >= 2)
+	Write_MSR(MSR_PERF_GLOBAL_CTRL, (1ULL << numUsed) - 1);
+
+    Read_Counters(s_lastRead[Get_CPU()->id]);
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Find and program the performance counters.
+ */
+void Init_Perf_Counters(void)
+{
+    ulong_t maxLeaf, eax, ebx, ecx, edx;
+    int i, next = 0;
+    int width, numEvents;
+
+    Read_CPUID(0, &maxLeaf, &ebx, &ecx, &edx);
+    if (maxLeaf < CPUID_LEAF_PERFMON) {
+	Print("No performance counters\n");
+	return;
+    }
+
+    Read_CPUID(CPUID_LEAF_PERFMON, &eax, &ebx, &ecx, &edx);
+    s_pmuVersion = eax & 0xff;
+    s_numCounters = (eax >> 8) & 0xff;
+    width = (eax >> 16) & 0xff;
+    numEvents = (eax >> 24) & 0xff;
+    if (s_pmuVersion == 0 || s_numCounters == 0 || width == 0) {
+	Print("No performance counters\n");
+	s_numCounters = 0;
+	return;
+    }
+    s_counterMask = (width >= 64) ? ~0ULL : (1ULL << width) - 1;
+
+    /*
+     * Only the first numEvents events are described by ebx,
+     * and the ones with their bit set are missing.
+     */
+    for (i = 0; i < NUM_PERF_EVENTS && next < s_numCounters; ++i) {
+	const struct Perf_Event_Info* info = &s_eventInfo[i];
+
+	if (info->unavailableBit >= numEvents || (ebx & (1 << info->unavailableBit)) != 0)
+	    continue;
+
+	s_counterFor[i] = next++;
+    }
+
+    Program_Counters();
+
+    Print("Performance counters: version %d, %d counters, %d bits, counting",
+	s_pmuVersion, s_numCounters, width);
+    for (i = 0; i < NUM_PERF_EVENTS; ++i) {
+	if (s_counterFor[i] >= 0)
+	    Print(" %s", s_eventInfo[i].name);
+    }
+    Print("\n");
+}
+
+/*
+ * Program the counters of an application processor
+ * the same way as the boot processor's.
+ */
+void Init_AP_Perf_Counters(void)
+{
+    if (s_numCounters > 0)
+	Program_Counters();
+}
+
+/*
+ * Is there a performance monitoring unit we can use?
+ */
+bool Perf_Counters_Present(void)
+{
+    return s_numCounters > 0;
+}
+
+/*
+ * Is given event being counted?
+ */
+bool Perf_Event_Present(enum Perf_Event event)
+{
+    KASSERT(event >= 0 && event < NUM_PERF_EVENTS);
+    return s_counterFor[event] >= 0;
+}
+
+const char* Get_Perf_Event_Name(enum Perf_Event event)
+{
+    KASSERT(event >= 0 && event < NUM_PERF_EVENTS);
+    return s_eventInfo[event].name;
+}
+
+/*
+ * Charge the events counted since the last charge to given
+ * thread, which is about to give up the CPU.
+ * Called by the scheduler with interrupts disabled.
+ */
+void Perf_Charge(struct Kernel_Thread* kthread)
+{
+    KASSERT(!Interrupts_Enabled());
+
+    if (s_numCounters == 0)
+	return;
+
+    Add_Pending_Counts(&kthread->perf, true);
+}
+
+/*
+ * Get the event counts for given thread.  For the current thread,
+ * this includes the events counted since it last got the CPU,
+ * so the difference of two readings measures the code in between.
+ */
+void Get_Thread_Perf_Counts(struct Kernel_Thread* kthread, struct Perf_Counts* counts)
+{
+    bool iflag = Begin_Int_Atomic();
+
+    *counts = kthread->perf;
+    if (kthread == g_currentThread && s_numCounters > 0)
+	Add_Pending_Counts(counts, false);
+
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Compute num * scale / den, for reporting ratios such as
+ * instructions per cycle.  Both counts are scaled down until
+ * the division fits in 32 bits, which loses some precision.
+ */
+ulong_t Perf_Ratio(unsigned long long num, unsigned long long den, ulong_t scale)
+{
+    unsigned long long product;
+
+    while ((den >> 32) != 0 || (num >> 32) != 0) {
+	num >>= 1;
+	den >>= 1;
+    }
+    if (den == 0)
+	return 0;
+
+    product = num * scale;
+    return Divide_64((ulong_t) (product >> 32), (ulong_t) product, (ulong_t) den);
+}
@@ -0,0 +1,200 @@
+/*
+ * Timer-driven sampling profiler
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/string.h>
+#include <geekos/int.h>
+#include <geekos/screen.h>
+#include <geekos/serial.h>
+#include <geekos/backtrace.h>
+#include <geekos/profile.h>
+
+/* ----------------------------------------------------------------------
+ * Private data and functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Histogram of sampled call stacks, kept as an open addressed
+ * hash table.  frames[0] is the interrupted instruction address,
+ * and the rest are return addresses found by walking the stack.
+ * An entry with a zero count is free.
+ */
+struct Profile_Entry {
+    ulong_t count;
+    int depth;
+    ulong_t frames[PROFILE_MAX_DEPTH];
+};
+static struct Profile_Entry s_profileTable[PROFILE_TABLE_SIZE];
+
+#define PROFILE_TABLE_MASK (PROFILE_TABLE_SIZE - 1)
+
+/*
+ * How far we probe for a free entry before giving up on a sample.
+ */
+#define PROFILE_MAX_PROBES 16
+
+/*
+ * Sampling interval in ticks (0 means off), and ticks left
+ * until the next sample.
+ */
+static int s_profileInterval = DEFAULT_PROFILE_INTERVAL;
+static int s_ticksToSample = DEFAULT_PROFILE_INTERVAL;
+
+static ulong_t s_numSamples;
+static ulong_t s_numDropped;
+
+/*
+ * Set while the table is being dumped.
+ */
+static volatile bool s_profilePaused;
+
+/*
+ * Hash a call stack (multiplicative hashing;
+ * the low bits of an address are poorly distributed).
+ */
+static ulong_t Hash_Stack(const ulong_t* frames, int depth)
+{
+    ulong_t hash = 0;
+    int i;
+
+    for (i = 0; i < depth; ++i)
+	hash = (hash ^ frames[i]) * 2654435761UL;
+    return hash >> (32 - PROFILE_TABLE_BITS);
+}
+
+static bool Same_Stack(const struct Profile_Entry* entry, const ulong_t* frames, int depth)
+{
+    int i;
+
+    if (entry->depth != depth)
+	return false;
+    for (i = 0; i < depth; ++i) {
+	if (entry->frames[i] != frames[i])
+	    return false;
+    }
+    return true;
+}
+
+static void Record_Sample(const ulong_t* frames, int depth)
+{
+    ulong_t index = Hash_Stack(frames, depth);
+    int probe;
+
+    ++s_numSamples;
+
+    for (probe = 0; probe < PROFILE_MAX_PROBES; ++probe) {
+	struct Profile_Entry* entry = &s_profileTable[(index + probe) & PROFILE_TABLE_MASK];
+
+	if (entry->count == 0) {
+	    memcpy(entry->frames, frames, depth * sizeof(ulong_t));
+	    entry->depth = depth;
+	}
+	if (Same_Stack(entry, frames, depth)) {
+	    ++entry->count;
+	    return;
+	}
+    }
+
+    ++s_numDropped;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Called from the timer interrupt handler on every tick;
+ * records the interrupted instruction address and its callers
+ * when the sampling interval has elapsed.
+ * If the interrupt arrived before the interrupted function set up
+ * its frame, its immediate caller is missing from the stack.
+ */
+void Profile_Tick(struct Interrupt_State* state)
+{
+    ulong_t frames[PROFILE_MAX_DEPTH];
+    int depth;
+
+    if (s_profileInterval == 0 || s_profilePaused)
+	return;
+
+    if (--s_ticksToSample > 0)
+	return;
+    s_ticksToSample = s_profileInterval;
+
+    frames[0] = state->eip;
+    depth = 1 + Get_Backtrace(state->ebp, &frames[1], PROFILE_MAX_DEPTH - 1);
+    Record_Sample(frames, depth);
+}
+
+/*
+ * Set the sampling interval in timer ticks.
+ * An interval of zero turns the profiler off.
+ */
+void Set_Profile_Interval(int ticks)
+{
+    bool iflag;
+
+    KASSERT(ticks >= 0);
+
+    iflag = Begin_Int_Atomic();
+    s_profileInterval = ticks;
+    s_ticksToSample = ticks;
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Discard all samples collected so far.
+ */
+void Reset_Profile(void)
+{
+    bool iflag = Begin_Int_Atomic();
+    memset(s_profileTable, '\0', sizeof(s_profileTable));
+    s_numSamples = 0;
+    s_numDropped = 0;
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Write the sample histogram to the serial port:
+ *
+ *   PROFILE-BEGIN <samples> <dropped>
+ *   P <count> <eip> <caller> <caller's caller> ...
+ *   ...
+ *   PROFILE-END
+ *
+ * with all fields in hex.  Use scripts/symprof to turn
+ * this into a flat profile or folded stacks.
+ * Sampling is paused while the dump is in progress.
+ */
+void Dump_Profile(void)
+{
+    int i;
+
+    if (!Serial_Present()) {
+	Print("No serial port for profile dump\n");
+	return;
+    }
+
+    s_profilePaused = true;
+
+    Print("Dumping %lu profile samples to serial port\n", s_numSamples);
+    Serial_Print("PROFILE-BEGIN %lx %lx\n", s_numSamples, s_numDropped);
+    for (i = 0; i < PROFILE_TABLE_SIZE; ++i) {
+	struct Profile_Entry* entry = &s_profileTable[i];
+	int j;
+
+	if (entry->count == 0)
+	    continue;
+	Serial_Print("P %lx", entry->count);
+	for (j = 0; j < entry->depth; ++j)
+	    Serial_Print(" %lx", entry->frames[j]);
+	Serial_Print("\n");
+    }
+    Serial_Print("PROFILE-END\n");
+
+    s_profilePaused = false;
+}
@@ -14,6 +14,8 @@
 #include <geekos/int.h>
 #include <geekos/fmtout.h>
 #include <geekos/screen.h>
+#include <geekos/string.h>
+#include <geekos/serial.h>
 
 /*
  * Information sources for VT100 and ANSI escape sequences:
@@ -160,6 +162,46 @@ static void Output_Literal_Character(int c)
      */
     Out_Byte(0xE9, c);
 #endif
+
+    if (g_serialMirror)
+	Serial_Put_Char(c);
+}
+
+/*
+ * Characters which Output_Literal_Character() or the escape
+ * sequence parser must look at individually.
+ */
+#define IS_PLAIN_CHAR(c) ((c) != ESC && (c) != '\n' && (c) != '\t')
+
+/*
+ * Write a run of plain characters, all of which fit on the current
+ * line, straight to video memory.  This is what Output_Literal_Character()
+ * would do for each of them, without the per-character overhead.
+ */
+static void Output_Plain_Span(const char* buf, ulong_t length)
+{
+    uchar_t* v = VIDMEM + s_cons.row*(NUMCOLS*2) + s_cons.col*2;
+    uchar_t attr = s_cons.currentAttr;
+    ulong_t i;
+
+    KASSERT(length <= (ulong_t) (NUMCOLS - s_cons.col));
+
+    for (i = 0; i < length; ++i) {
+	*v++ = (uchar_t) buf[i];
+	*v++ = attr;
+    }
+
+    s_cons.col += length;
+    if (s_cons.col == NUMCOLS)
+	Newline();
+
+#ifndef NDEBUG
+    for (i = 0; i < length; ++i)
+	Out_Byte(0xE9, buf[i]);
+#endif
+
+    if (g_serialMirror)
+	Serial_Put_Buf(buf, length);
 }
 
 /*
@@ -347,6 +389,33 @@ again:
     }
 }
 
+/*
+ * Output a buffer of characters.  Runs of plain characters are
+ * written a line at a time; only escape sequences and special
+ * characters go through Put_Char_Imp().
+ */
+static void Put_Span_Imp(const char* buf, ulong_t length)
+{
+    while (length > 0) {
+	if (s_cons.state == S_NORMAL) {
+	    ulong_t room = NUMCOLS - s_cons.col;
+	    ulong_t n = 0;
+
+	    while (n < length && n < room && IS_PLAIN_CHAR(buf[n]))
+		++n;
+	    if (n > 0) {
+		Output_Plain_Span(buf, n);
+		buf += n;
+		length -= n;
+		continue;
+	    }
+	}
+
+	Put_Char_Imp(*buf++);
+	--length;
+    }
+}
+
 /*
  * Update the location of the hardware cursor.
  */
@@ -487,8 +556,7 @@ void Put_Char(int c)
 void Put_String(const char* s)
 {
     bool iflag = Begin_Int_Atomic();
-    while (*s != '\0')
-	Put_Char_Imp(*s++);
+    Put_Span_Imp(s, strlen(s));
     Update_Cursor();
     End_Int_Atomic(iflag);
 }
@@ -500,18 +568,43 @@ void Put_String(const char* s)
 void Put_Buf(const char* buf, ulong_t length)
 {
     bool iflag = Begin_Int_Atomic();
-    while (length > 0) {
-	Put_Char_Imp(*buf++);
-	--length;
-    }
+    Put_Span_Imp(buf, length);
     Update_Cursor();
     End_Int_Atomic(iflag);
 }
 
-/* Support for Print(). */
-static void Print_Emit(struct Output_Sink *o, int ch) { Put_Char_Imp(ch); }
-static void Print_Finish(struct Output_Sink *o) { Update_Cursor(); }
-static struct Output_Sink s_outputSink = { &Print_Emit, &Print_Finish };
+/*
+ * Support for Print().
+ * Formatted output is collected in a buffer on the caller's stack
+ * and written to the screen a buffer at a time.
+ */
+#define PRINT_BUF_SIZE 128
+
+struct Print_Output_Sink {
+    struct Output_Sink o;
+    ulong_t n;
+    char buf[PRINT_BUF_SIZE];
+};
+
+static void Print_Emit(struct Output_Sink *o_, int ch)
+{
+    struct Print_Output_Sink *o = (struct Print_Output_Sink*) o_;
+
+    if (o->n == PRINT_BUF_SIZE) {
+	Put_Span_Imp(o->buf, o->n);
+	o->n = 0;
+    }
+    o->buf[o->n++] = ch;
+}
+
+static void Print_Finish(struct Output_Sink *o_)
+{
+    struct Print_Output_Sink *o = (struct Print_Output_Sink*) o_;
+
+    Put_Span_Imp(o->buf, o->n);
+    o->n = 0;
+    Update_Cursor();
+}
 
 /*
  * Print to console using printf()-style formatting.
@@ -520,11 +613,16 @@ static struct Output_Sink s_outputSink = { &Print_Emit, &Print_Finish };
 void Print(const char *fmt, ...)
 {
     va_list args;
+    struct Print_Output_Sink sink;
 
     bool iflag = Begin_Int_Atomic();
 
+    sink.o.Emit = &Print_Emit;
+    sink.o.Finish = &Print_Finish;
+    sink.n = 0;
+
     va_start(args, fmt);
-    Format_Output(&s_outputSink, fmt, args);
+    Format_Output(&sink.o, fmt, args);
     va_end(args);
 
     End_Int_Atomic(iflag);
@@ -0,0 +1,313 @@
+/*
+ * Serial port (16550 UART) driver
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * Output only.  Characters are queued in a ring buffer, and
+ * the transmit interrupt refills the UART's 16 byte FIFO from it,
+ * so writers don't wait for the (slow) serial line.  If the ring
+ * fills up, a writer that can sleep waits for the transmit interrupt
+ * to make room.  One that can't (interrupts disabled, e.g. early in
+ * boot or when mirroring the screen) feeds the FIFO itself, but only
+ * for a bounded time, so a stuck UART can't hang the kernel.
+ */
+
+#include <stdarg.h>
+#include <geekos/kassert.h>
+#include <geekos/int.h>
+#include <geekos/irq.h>
+#include <geekos/io.h>
+#include <geekos/fmtout.h>
+#include <geekos/kthread.h>
+#include <geekos/serial.h>
+
+/* ----------------------------------------------------------------------
+ * Private data and functions
+ * ---------------------------------------------------------------------- */
+
+#define SERIAL_BAUD 115200
+
+/*
+ * Transmit ring buffer.  Only accessed with interrupts disabled.
+ * TX_RING_SIZE must be a power of two.
+ */
+#define TX_RING_SIZE 4096
+#define TX_RING_MASK (TX_RING_SIZE - 1)
+static uchar_t s_txRing[TX_RING_SIZE];
+static int s_txHead, s_txTail;
+
+/*
+ * True while the transmit interrupt is enabled,
+ * i.e., while there is queued output.
+ */
+static bool s_txActive;
+
+/*
+ * Threads waiting for room in the ring, or for it to drain.
+ * Woken by the transmit interrupt.
+ */
+static struct Thread_Queue s_txWaitQueue;
+
+/*
+ * How many times to poll the UART for room before giving up and
+ * discarding output, when the writer can't sleep.  A port read
+ * takes about a microsecond, so this is ~100 ms; a working UART
+ * drains its FIFO in under 2 ms.
+ */
+#define SERIAL_SPIN_LIMIT 100000
+
+static bool s_serialPresent;
+
+bool g_serialMirror;
+
+static __inline__ bool Is_TX_Ring_Empty(void)
+{
+    return s_txHead == s_txTail;
+}
+
+static __inline__ bool Is_TX_Ring_Full(void)
+{
+    return ((s_txTail + 1) & TX_RING_MASK) == s_txHead;
+}
+
+/*
+ * If the transmit FIFO is empty, fill it from the ring buffer.
+ * Must be called with interrupts disabled.
+ */
+static void Fill_TX_FIFO(void)
+{
+    int i;
+
+    if ((In_Byte(COM1_BASE + UART_LSR) & UART_LSR_THRE) == 0)
+	return;
+
+    for (i = 0; i < UART_FIFO_SIZE && !Is_TX_Ring_Empty(); ++i) {
+	Out_Byte(COM1_BASE + UART_DATA, s_txRing[s_txHead]);
+	s_txHead = (s_txHead + 1) & TX_RING_MASK;
+    }
+}
+
+/*
+ * Can the caller sleep waiting for the transmit interrupt?
+ * iflag is whether interrupts were enabled on entry to the driver.
+ * Must be called with interrupts disabled.
+ */
+static __inline__ bool Can_Wait(bool iflag)
+{
+    return iflag && !g_preemptionDisabled && g_currentThread != 0;
+}
+
+/*
+ * Queue one byte for transmission.  If the ring is full, wait
+ * for room, or if we can't sleep, feed the UART ourselves.
+ * The byte is dropped if the UART won't take anything.
+ * Must be called with interrupts disabled.
+ */
+static void Queue_TX_Byte(uchar_t c, bool canWait)
+{
+    int spins = 0;
+
+    while (Is_TX_Ring_Full()) {
+	if (canWait)
+	    Wait(&s_txWaitQueue);
+	else if (spins++ < SERIAL_SPIN_LIMIT)
+	    Fill_TX_FIFO();
+	else
+	    return;
+    }
+
+    s_txRing[s_txTail] = c;
+    s_txTail = (s_txTail + 1) & TX_RING_MASK;
+
+    if (!s_txActive) {
+	s_txActive = true;
+	Fill_TX_FIFO();
+	Out_Byte(COM1_BASE + UART_IER, UART_IER_THRE);
+    }
+}
+
+/*
+ * Write a character, translating newlines for the terminal.
+ * Must be called with interrupts disabled.
+ */
+static void Serial_Put_Char_Imp(int c, bool canWait)
+{
+    if (c == '\n')
+	Queue_TX_Byte('\r', canWait);
+    Queue_TX_Byte(c, canWait);
+}
+
+static void Serial_Interrupt_Handler(struct Interrupt_State* state)
+{
+    Begin_IRQ(state);
+
+    /* Reading IIR acknowledges the transmit interrupt. */
+    In_Byte(COM1_BASE + UART_IIR);
+
+    /*
+     * Keep the interrupt on until the FIFO has drained with nothing
+     * left to send, so once s_txActive is clear the only byte still
+     * going out is the one in the shift register.
+     */
+    if (Is_TX_Ring_Empty()) {
+	Out_Byte(COM1_BASE + UART_IER, 0);
+	s_txActive = false;
+    } else {
+	Fill_TX_FIFO();
+    }
+    Wake_Up(&s_txWaitQueue);
+
+    End_IRQ(state);
+}
+
+/*
+ * Output sink for Serial_Print().
+ */
+struct Serial_Output_Sink {
+    struct Output_Sink o;
+    bool canWait;
+};
+
+static void Serial_Emit(struct Output_Sink *o_, int ch)
+{
+    struct Serial_Output_Sink *o = (struct Serial_Output_Sink*) o_;
+
+    Serial_Put_Char_Imp(ch, o->canWait);
+}
+
+static void Serial_Finish(struct Output_Sink *o) { }
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Initialize COM1, and start mirroring screen output to it.
+ * If there's no UART, output to the serial port is discarded.
+ */
+void Init_Serial(void)
+{
+    ushort_t divisor = UART_CLOCK / SERIAL_BAUD;
+
+    /* Check that there is a UART there, using the scratch register */
+    Out_Byte(COM1_BASE + UART_SCRATCH, 0x5A);
+    if (In_Byte(COM1_BASE + UART_SCRATCH) != 0x5A)
+	return;
+
+    Out_Byte(COM1_BASE + UART_IER, 0);
+    Out_Byte(COM1_BASE + UART_LCR, UART_LCR_DLAB);
+    Out_Byte(COM1_BASE + UART_DATA, divisor & 0xff);
+    Out_Byte(COM1_BASE + UART_IER, divisor >> 8);
+    Out_Byte(COM1_BASE + UART_LCR, UART_LCR_8N1);
+    Out_Byte(COM1_BASE + UART_FCR, UART_FCR_ENABLE | UART_FCR_CLEAR | UART_FCR_TRIG_14);
+    Out_Byte(COM1_BASE + UART_MCR, UART_MCR_DTR | UART_MCR_RTS | UART_MCR_OUT2);
+
+    /* An 8250 or 16450 has no FIFO; we'd overrun it. */
+    if ((In_Byte(COM1_BASE + UART_IIR) & UART_IIR_FIFO) != UART_IIR_FIFO) {
+	Out_Byte(COM1_BASE + UART_MCR, 0);
+	return;
+    }
+
+    s_txHead = s_txTail = 0;
+    s_txActive = false;
+    Clear_Thread_Queue(&s_txWaitQueue);
+
+    Install_IRQ(COM1_IRQ, Serial_Interrupt_Handler);
+    Enable_IRQ(COM1_IRQ);
+
+    s_serialPresent = true;
+    g_serialMirror = true;
+}
+
+/*
+ * Is there a working serial port?
+ */
+bool Serial_Present(void)
+{
+    return s_serialPresent;
+}
+
+/*
+ * Write a character to the serial port.
+ */
+void Serial_Put_Char(int c)
+{
+    bool iflag;
+
+    if (!s_serialPresent)
+	return;
+
+    iflag = Begin_Int_Atomic();
+    Serial_Put_Char_Imp(c, Can_Wait(iflag));
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Write a buffer of characters to the serial port.
+ */
+void Serial_Put_Buf(const char* buf, ulong_t length)
+{
+    bool iflag, canWait;
+
+    if (!s_serialPresent)
+	return;
+
+    iflag = Begin_Int_Atomic();
+    canWait = Can_Wait(iflag);
+    while (length-- > 0)
+	Serial_Put_Char_Imp(*buf++, canWait);
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Print to the serial port only, using printf()-style formatting.
+ */
+void Serial_Print(const char* fmt, ...)
+{
+    va_list args;
+    struct Serial_Output_Sink sink;
+    bool iflag;
+
+    if (!s_serialPresent)
+	return;
+
+    iflag = Begin_Int_Atomic();
+    sink.o.Emit = &Serial_Emit;
+    sink.o.Finish = &Serial_Finish;
+    sink.canWait = Can_Wait(iflag);
+    va_start(args, fmt);
+    Format_Output(&sink.o, fmt, args);
+    va_end(args);
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Wait until all queued output has been transmitted.
+ * If called with interrupts disabled, gives up after a while
+ * if the UART stops transmitting.
+ */
+void Serial_Flush(void)
+{
+    bool iflag;
+    int spins = 0;
+
+    if (!s_serialPresent)
+	return;
+
+    iflag = Begin_Int_Atomic();
+    if (Can_Wait(iflag)) {
+	while (s_txActive)
+	    Wait(&s_txWaitQueue);
+    } else {
+	while (!Is_TX_Ring_Empty() && spins++ < SERIAL_SPIN_LIMIT)
+	    Fill_TX_FIFO();
+    }
+
+    /* At most a FIFO's worth is left to go; that's short enough to poll */
+    while ((In_Byte(COM1_BASE + UART_LSR) & UART_LSR_TEMT) == 0 && spins++ < SERIAL_SPIN_LIMIT)
+	;
+    End_Int_Atomic(iflag);
+}
@@ -72,13 +72,70 @@ setup_32:
 	; Create the stack for the initial kernel thread.
 	mov	esp, KERN_STACK + 4096
 
+%ifdef COMPRESSED_KERNEL
+	; Decompress the kernel image in place to KERNSEG.
+	; See src/tools/lzss.c for the format.
+	; The time it takes is kept in ebx, for the Boot_Info struct.
+	rdtsc
+	mov	ebx, eax
+	cld
+	mov	esi, (KERNSEG<<4) + KERN_LOAD_OFFSET
+	mov	edi, KERNSEG<<4
+	lodsd				; uncompressed size
+	lea	ebp, [edi+eax]		; end of the kernel image
+
+.nextFlags:
+	cmp	edi, ebp
+	jae	.inflated
+	lodsb				; flag byte for the next 8 items
+	mov	dl, al
+	mov	dh, 8
+
+.nextItem:
+	cmp	edi, ebp
+	jae	.inflated
+	shr	dl, 1			; next flag bit in carry
+	jnc	.match
+	movsb				; literal byte
+	jmp	.itemDone
+
+.match:
+	xor	eax, eax
+	lodsw				; distance-1 in low 12 bits,
+	mov	ecx, eax		;   length-3 in high 4 bits
+	shr	ecx, 12
+	add	ecx, 3
+	and	eax, 0x0fff
+	inc	eax
+	push	esi
+	mov	esi, edi
+	sub	esi, eax
+	rep	movsb			; byte at a time, since it may overlap
+	pop	esi
+
+.itemDone:
+	dec	dh
+	jnz	.nextItem
+	jmp	.nextFlags
+
+.inflated:
+	rdtsc
+	sub	eax, ebx
+	mov	ebx, eax		; cycles spent decompressing
+%else
+	xor	ebx, ebx		; nothing to decompress
+%endif
+
 	; Build Boot_Info struct on stack.
 	; Note that we push the fields on in reverse order,
 	; since the stack grows downwards.
+	push	ebx		; decompressCycles
 	xor	eax, eax
+	mov	ax, [(INITSEG<<4)+LOAD_TICKS_OFFSET]
+	push	eax		; loadTicks (recorded by the boot sector)
 	mov	ax, [(SETUPSEG<<4)+mem_size_kbytes]
 	push	eax		; memSizeKB
-	push	dword 8		; bootInfoSize
+	push	dword 16	; bootInfoSize
 
 	; Pass pointer to Boot_Info struct as argument to kernel
 	; entry point.
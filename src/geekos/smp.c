@@ -0,0 +1,890 @@
+/*
+ * Multiprocessor support
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+/*
+ * Information sources:
+ * - Advanced Configuration and Power Interface Specification,
+ *   version 6.4, section 5.2 (the RSDP, RSDT and MADT).
+ * - Intel MultiProcessor Specification, version 1.4.
+ */
+
+/*
+ * This module finds the processors, the local APICs and the
+ * I/O APIC, and starts the application processors (APs).
+ * The ACPI MADT is used if there is one, the MP configuration
+ * table otherwise.
+ *
+ * All processors run the same scheduler, from the same run queue.
+ * Mutual exclusion still comes from disabling interrupts: doing so
+ * takes the kernel lock (see int.h), so only one processor at a time
+ * runs kernel code with interrupts disabled.  Each processor has a
+ * struct CPU, selected by its fs segment register, holding its
+ * current thread and scheduling flags.
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/screen.h>
+#include <geekos/string.h>
+#include <geekos/cpu.h>
+#include <geekos/io.h>
+#include <geekos/int.h>
+#include <geekos/idt.h>
+#include <geekos/irq.h>
+#include <geekos/gdt.h>
+#include <geekos/segment.h>
+#include <geekos/tss.h>
+#include <geekos/timer.h>
+#include <geekos/perfctr.h>
+#include <geekos/serial.h>
+#include <geekos/kthread.h>
+#include <geekos/apic.h>
+#include <geekos/smp.h>
+
+/* ----------------------------------------------------------------------
+ * Private data and functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * ACPI root system description pointer.
+ * Revision 2 adds fields we don't use.
+ */
+struct ACPI_RSDP {
+    char signature[8];		/* "RSD PTR " */
+    uchar_t checksum;		/* Over the first 20 bytes */
+    char oemId[6];
+    uchar_t revision;
+    ulong_t rsdtAddr;
+};
+#define ACPI_RSDP_CHECKSUM_LENGTH 20
+
+/*
+ * Header of every ACPI system description table.
+ */
+struct ACPI_Header {
+    char signature[4];
+    ulong_t length;
+    uchar_t revision;
+    uchar_t checksum;
+    char oemId[6];
+    char oemTableId[8];
+    ulong_t oemRevision;
+    ulong_t creatorId;
+    ulong_t creatorRevision;
+};
+
+/*
+ * Multiple APIC description table (signature "APIC").
+ * Variable length entries follow it.
+ */
+struct ACPI_MADT {
+    struct ACPI_Header header;
+    ulong_t localApicAddr;
+    ulong_t flags;
+};
+#define MADT_PCAT_COMPAT 0x01
+
+/*
+ * MADT entry types, and the entries we use.
+ */
+#define MADT_ENTRY_LOCAL_APIC  0
+#define MADT_ENTRY_IO_APIC     1
+#define MADT_ENTRY_INT_OVERRIDE 2
+
+struct MADT_Entry_Header {
+    uchar_t type;
+    uchar_t length;
+};
+
+struct MADT_Local_APIC {
+    struct MADT_Entry_Header header;
+    uchar_t processorId;
+    uchar_t apicId;
+    ulong_t flags;
+};
+#define MADT_CPU_ENABLED 0x01
+
+struct MADT_IO_APIC {
+    struct MADT_Entry_Header header;
+    uchar_t apicId;
+    uchar_t reserved;
+    ulong_t address;
+    ulong_t gsiBase;
+};
+
+struct MADT_Int_Override {
+    struct MADT_Entry_Header header;
+    uchar_t bus;		/* Always 0 (ISA) */
+    uchar_t sourceIrq;
+    ulong_t gsi;
+    ushort_t flags;		/* Polarity and trigger mode */
+};
+
+/*
+ * MP floating pointer structure.
+ */
+struct MP_Floating_Pointer {
+    char signature[4];		/* "_MP_" */
+    ulong_t configTable;	/* Physical address of config table, or 0 */
+    uchar_t length;		/* In 16 byte units */
+    uchar_t specRev;
+    uchar_t checksum;
+    uchar_t feature[5];		/* feature[0] != 0 means a default configuration */
+};
+#define MP_FEATURE_IMCR 0x80	/* In feature[1]: PIC mode, with an IMCR */
+
+/*
+ * MP configuration table header.
+ * Variable length entries follow it.
+ */
+struct MP_Config_Header {
+    char signature[4];		/* "PCMP" */
+    ushort_t length;
+    uchar_t specRev;
+    uchar_t checksum;
+    char oemId[8];
+    char productId[12];
+    ulong_t oemTable;
+    ushort_t oemTableSize;
+    ushort_t entryCount;
+    ulong_t localApicAddr;
+    ushort_t extLength;
+    uchar_t extChecksum;
+    uchar_t reserved;
+};
+
+/*
+ * Configuration table entry types, and the entries we use.
+ */
+#define MP_ENTRY_PROCESSOR 0
+#define MP_ENTRY_BUS       1
+#define MP_ENTRY_IO_APIC   2
+#define MP_ENTRY_IO_INT    3
+#define MP_ENTRY_LOCAL_INT 4
+
+struct MP_Processor_Entry {
+    uchar_t type;
+    uchar_t apicId;
+    uchar_t apicVersion;
+    uchar_t cpuFlags;
+    ulong_t signature;
+    ulong_t featureFlags;
+    ulong_t reserved[2];
+};
+#define MP_CPU_ENABLED 0x01
+#define MP_CPU_BOOT    0x02
+
+struct MP_Bus_Entry {
+    uchar_t type;
+    uchar_t busId;
+    char busType[6];		/* "ISA   " for the ISA bus */
+};
+
+struct MP_IO_APIC_Entry {
+    uchar_t type;
+    uchar_t apicId;
+    uchar_t apicVersion;
+    uchar_t flags;
+    ulong_t address;
+};
+
+struct MP_IO_Int_Entry {
+    uchar_t type;
+    uchar_t intType;		/* 0 for a vectored interrupt */
+    ushort_t flags;		/* Polarity and trigger mode */
+    uchar_t sourceBus;
+    uchar_t sourceIrq;
+    uchar_t destApicId;
+    uchar_t destPin;
+};
+#define MP_INT_VECTORED 0
+#define MP_ALL_IO_APICS 0xff
+
+/*
+ * Polarity and trigger mode flags, encoded the same way in the MADT
+ * and the MP table.  "Conforms to the bus" means active high and edge
+ * triggered for ISA.
+ */
+#define INT_POLARITY_MASK    0x03
+#define INT_POLARITY_LOW     0x03
+#define INT_TRIGGER_MASK     0x0c
+#define INT_TRIGGER_LEVEL    0x0c
+
+/*
+ * BIOS data area locations, and default APIC addresses.
+ */
+#define BDA_EBDA_SEGMENT  0x40E
+#define BDA_BASE_MEM_KB   0x413
+#define BIOS_ROM_START    0xE0000
+#define BIOS_ROM_LENGTH   0x20000
+#define MP_BIOS_ROM_START 0xF0000
+#define MP_BIOS_ROM_LENGTH 0x10000
+#define DEFAULT_LOCAL_APIC_ADDR 0xFEE00000
+#define DEFAULT_IO_APIC_ADDR    0xFEC00000
+
+/*
+ * The IMCR selects whether the PICs or the APICs deliver
+ * interrupts on systems that boot in PIC mode.
+ */
+#define IMCR_SELECT_PORT 0x22
+#define IMCR_DATA_PORT   0x23
+#define IMCR_SELECT      0x70
+#define IMCR_APIC_MODE   0x01
+
+/*
+ * Asking the BIOS for a warm reset: the CMOS shutdown code,
+ * and the real mode far pointer it jumps through.
+ */
+#define CMOS_ADDR_PORT      0x70
+#define CMOS_DATA_PORT      0x71
+#define CMOS_SHUTDOWN_CODE  0x0F
+#define CMOS_WARM_RESET     0x0A
+#define WARM_RESET_VECTOR   0x467
+
+/*
+ * Delays when starting an AP, in microseconds, and how long to
+ * wait for it to come online, in timer ticks (about one second).
+ */
+#define INIT_DELAY_US   10000
+#define STARTUP_DELAY_US 200
+#define AP_ONLINE_TICKS 18
+
+/*
+ * Trampoline code and data (see trampoline.asm).
+ */
+extern char g_trampolineStart, g_trampolineEnd;
+extern char g_trampolineGDTR, g_trampolineStack, g_trampolineArg, g_trampolineEntry;
+
+/*
+ * The processors.  The boot processor is always s_cpus[0].
+ */
+static struct CPU s_cpus[MAX_CPUS];
+static int s_numCPUs;
+static ulong_t s_localApicAddr, s_ioApicAddr;
+static bool s_imcrPresent;
+
+/*
+ * Where the ISA IRQs are connected to the I/O APIC.
+ */
+static struct ISA_IRQ_Route s_isaRoutes[16];
+static bool s_isaRouted[16];
+
+static uchar_t Checksum(const void* buf, ulong_t length)
+{
+    const uchar_t* p = (const uchar_t*) buf;
+    uchar_t sum = 0;
+
+    while (length-- > 0)
+	sum += *p++;
+    return sum;
+}
+
+/*
+ * Set the I/O APIC pin, polarity and trigger mode of an ISA IRQ.
+ */
+static void Set_ISA_IRQ_Route(int irq, int pin, ushort_t flags)
+{
+    if (irq < 0 || irq >= 16)
+	return;
+
+    s_isaRoutes[irq].pin = pin;
+    s_isaRoutes[irq].activeLow = (flags & INT_POLARITY_MASK) == INT_POLARITY_LOW;
+    s_isaRoutes[irq].levelTriggered = (flags & INT_TRIGGER_MASK) == INT_TRIGGER_LEVEL;
+    s_isaRouted[irq] = true;
+}
+
+/*
+ * Unless the firmware says otherwise, ISA IRQ n is connected to
+ * I/O APIC pin n.  IRQ 2 is the PIC cascade, and never used.
+ */
+static void Init_ISA_IRQ_Routes(void)
+{
+    int irq;
+
+    for (irq = 0; irq < 16; ++irq)
+	Set_ISA_IRQ_Route(irq, irq, 0);
+    s_isaRouted[2] = false;
+}
+
+static void Add_CPU(uchar_t apicId, uchar_t apicVersion, bool bootProcessor)
+{
+    struct CPU* cpu;
+
+    if (bootProcessor) {
+	cpu = &s_cpus[0];
+    } else if (s_numCPUs == MAX_CPUS) {
+	Print("Ignoring processor %d: too many processors\n", apicId);
+	return;
+    } else {
+	cpu = &s_cpus[s_numCPUs];
+	cpu->id = s_numCPUs++;
+    }
+
+    cpu->apicId = apicId;
+    cpu->apicVersion = apicVersion;
+}
+
+/*
+ * Look for a structure with given signature on a 16 byte boundary
+ * in given range of physical memory.  Returns null if not found.
+ */
+static void* Scan_For(const char* signature, ulong_t sigLength, ulong_t start, ulong_t length)
+{
+    ulong_t addr;
+
+    for (addr = start; addr + 16 <= start + length; addr += 16) {
+	if (memcmp((void*) addr, signature, sigLength) == 0)
+	    return (void*) addr;
+    }
+
+    return 0;
+}
+
+/*
+ * Look for the MP floating pointer structure in given range
+ * of physical memory.  Returns null if not found.
+ */
+static struct MP_Floating_Pointer* Scan_For_MP(ulong_t start, ulong_t length)
+{
+    ulong_t end = start + length;
+
+    while (length > 0) {
+	struct MP_Floating_Pointer* mp = Scan_For("_MP_", 4, start, length);
+
+	if (mp == 0)
+	    break;
+	if (mp->length > 0 && Checksum(mp, mp->length * 16) == 0)
+	    return mp;
+	start = (ulong_t) mp + 16;
+	length = end - start;
+    }
+
+    return 0;
+}
+
+/*
+ * Look for the ACPI RSDP in given range of physical memory.
+ * Returns null if not found.
+ */
+static struct ACPI_RSDP* Scan_For_RSDP(ulong_t start, ulong_t length)
+{
+    ulong_t end = start + length;
+
+    while (length > 0) {
+	struct ACPI_RSDP* rsdp = Scan_For("RSD PTR ", 8, start, length);
+
+	if (rsdp == 0)
+	    break;
+	if (Checksum(rsdp, ACPI_RSDP_CHECKSUM_LENGTH) == 0)
+	    return rsdp;
+	start = (ulong_t) rsdp + 16;
+	length = end - start;
+    }
+
+    return 0;
+}
+
+/*
+ * Find the MP floating pointer structure.  It is in the first KB
+ * of the extended BIOS data area, the last KB of base memory,
+ * or the BIOS ROM.
+ */
+static struct MP_Floating_Pointer* Find_MP(void)
+{
+    struct MP_Floating_Pointer* mp = 0;
+    ulong_t ebda = ((ulong_t) *((ushort_t*) BDA_EBDA_SEGMENT)) << 4;
+    ulong_t baseMemTop = ((ulong_t) *((ushort_t*) BDA_BASE_MEM_KB)) * 1024;
+
+    if (ebda != 0)
+	mp = Scan_For_MP(ebda, 1024);
+    if (mp == 0 && baseMemTop >= 1024)
+	mp = Scan_For_MP(baseMemTop - 1024, 1024);
+    if (mp == 0)
+	mp = Scan_For_MP(MP_BIOS_ROM_START, MP_BIOS_ROM_LENGTH);
+
+    return mp;
+}
+
+/*
+ * Find the ACPI RSDP.  It is in the first KB of the extended
+ * BIOS data area, or between 0xE0000 and 0xFFFFF.
+ */
+static struct ACPI_RSDP* Find_RSDP(void)
+{
+    struct ACPI_RSDP* rsdp = 0;
+    ulong_t ebda = ((ulong_t) *((ushort_t*) BDA_EBDA_SEGMENT)) << 4;
+
+    if (ebda != 0)
+	rsdp = Scan_For_RSDP(ebda, 1024);
+    if (rsdp == 0)
+	rsdp = Scan_For_RSDP(BIOS_ROM_START, BIOS_ROM_LENGTH);
+
+    return rsdp;
+}
+
+/*
+ * Find the MADT through the RSDT.  Returns null if there isn't one.
+ */
+static struct ACPI_MADT* Find_MADT(void)
+{
+    struct ACPI_RSDP* rsdp = Find_RSDP();
+    struct ACPI_Header* rsdt;
+    ulong_t* tables;
+    int i, numTables;
+
+    if (rsdp == 0 || rsdp->rsdtAddr == 0)
+	return 0;
+
+    rsdt = (struct ACPI_Header*) rsdp->rsdtAddr;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 || Checksum(rsdt, rsdt->length) != 0)
+	return 0;
+
+    tables = (ulong_t*) (rsdt + 1);
+    numTables = (rsdt->length - sizeof(struct ACPI_Header)) / sizeof(ulong_t);
+    for (i = 0; i < numTables; ++i) {
+	struct ACPI_Header* table = (struct ACPI_Header*) tables[i];
+	if (memcmp(table->signature, "APIC", 4) == 0 && Checksum(table, table->length) == 0)
+	    return (struct ACPI_MADT*) table;
+    }
+
+    return 0;
+}
+
+/*
+ * Read the processors, I/O APIC and ISA IRQ routing from the MADT.
+ */
+static void Parse_MADT(struct ACPI_MADT* madt)
+{
+    uchar_t* entry = (uchar_t*) (madt + 1);
+    uchar_t* end = ((uchar_t*) madt) + madt->header.length;
+    ulong_t ioApicGsiBase = 0;
+    uchar_t bootId, version;
+
+    s_localApicAddr = madt->localApicAddr;
+    bootId = Get_Local_APIC_ID();
+    version = Get_Local_APIC_Version();
+
+    while (entry + sizeof(struct MADT_Entry_Header) <= end) {
+	struct MADT_Entry_Header* header = (struct MADT_Entry_Header*) entry;
+
+	if (header->length < sizeof(struct MADT_Entry_Header))
+	    break;
+
+	switch (header->type) {
+	case MADT_ENTRY_LOCAL_APIC:
+	    {
+		struct MADT_Local_APIC* lapic = (struct MADT_Local_APIC*) entry;
+		if (lapic->flags & MADT_CPU_ENABLED)
+		    Add_CPU(lapic->apicId, version, lapic->apicId == bootId);
+	    }
+	    break;
+
+	case MADT_ENTRY_IO_APIC:
+	    {
+		struct MADT_IO_APIC* ioApic = (struct MADT_IO_APIC*) entry;
+		/* We only care about the first one */
+		if (s_ioApicAddr == 0) {
+		    s_ioApicAddr = ioApic->address;
+		    ioApicGsiBase = ioApic->gsiBase;
+		}
+	    }
+	    break;
+
+	case MADT_ENTRY_INT_OVERRIDE:
+	    {
+		struct MADT_Int_Override* override = (struct MADT_Int_Override*) entry;
+		if (override->bus == 0 && override->gsi >= ioApicGsiBase)
+		    Set_ISA_IRQ_Route(override->sourceIrq, override->gsi - ioApicGsiBase,
+			override->flags);
+	    }
+	    break;
+	}
+
+	entry += header->length;
+    }
+
+    /* Systems with the PICs need the cascade line left alone */
+    if (madt->flags & MADT_PCAT_COMPAT)
+	s_isaRouted[2] = false;
+}
+
+/*
+ * Read the processors, I/O APIC and ISA IRQ routing from the
+ * MP configuration table.  Returns false if the table is bad.
+ */
+static bool Parse_MP_Config(struct MP_Config_Header* config)
+{
+    uchar_t* entry;
+    ulong_t isaBuses = 0;
+    uchar_t ioApicId = 0;
+    int i;
+
+    if (memcmp(config->signature, "PCMP", 4) != 0 || Checksum(config, config->length) != 0)
+	return false;
+
+    s_localApicAddr = config->localApicAddr;
+
+    entry = (uchar_t*) (config + 1);
+    for (i = 0; i < config->entryCount; ++i) {
+	switch (*entry) {
+	case MP_ENTRY_PROCESSOR:
+	    {
+		struct MP_Processor_Entry* proc = (struct MP_Processor_Entry*) entry;
+		if (proc->cpuFlags & MP_CPU_ENABLED)
+		    Add_CPU(proc->apicId, proc->apicVersion, (proc->cpuFlags & MP_CPU_BOOT) != 0);
+		entry += sizeof(struct MP_Processor_Entry);
+	    }
+	    break;
+
+	case MP_ENTRY_BUS:
+	    {
+		struct MP_Bus_Entry* bus = (struct MP_Bus_Entry*) entry;
+		if (memcmp(bus->busType, "ISA", 3) == 0 && bus->busId < 32)
+		    isaBuses |= 1UL << bus->busId;
+		entry += sizeof(struct MP_Bus_Entry);
+	    }
+	    break;
+
+	case MP_ENTRY_IO_APIC:
+	    {
+		struct MP_IO_APIC_Entry* ioApic = (struct MP_IO_APIC_Entry*) entry;
+		/* We only care about the first one */
+		if (s_ioApicAddr == 0 && (ioApic->flags & 1)) {
+		    s_ioApicAddr = ioApic->address;
+		    ioApicId = ioApic->apicId;
+		}
+		entry += sizeof(struct MP_IO_APIC_Entry);
+	    }
+	    break;
+
+	case MP_ENTRY_IO_INT:
+	    {
+		/* Bus entries come first, so we know which buses are ISA */
+		struct MP_IO_Int_Entry* intr = (struct MP_IO_Int_Entry*) entry;
+		if (intr->intType == MP_INT_VECTORED && intr->sourceBus < 32 &&
+		    (isaBuses & (1UL << intr->sourceBus)) != 0 &&
+		    (intr->destApicId == ioApicId || intr->destApicId == MP_ALL_IO_APICS))
+		    Set_ISA_IRQ_Route(intr->sourceIrq, intr->destPin, intr->flags);
+		entry += sizeof(struct MP_IO_Int_Entry);
+	    }
+	    break;
+
+	case MP_ENTRY_LOCAL_INT:
+	    entry += 8;
+	    break;
+
+	default:
+	    Print("Unknown MP config entry type %d\n", *entry);
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+/*
+ * Read the MP tables.  Returns false if there's no usable configuration.
+ */
+static bool Parse_MP(struct MP_Floating_Pointer* mp)
+{
+    s_imcrPresent = (mp->feature[1] & MP_FEATURE_IMCR) != 0;
+
+    if (mp->feature[0] != 0) {
+	/*
+	 * One of the default configurations: two processors, APIC ids
+	 * 0 and 1, and IRQ 0 connected to I/O APIC pin 2.
+	 */
+	uchar_t bootId, version;
+
+	s_localApicAddr = DEFAULT_LOCAL_APIC_ADDR;
+	s_ioApicAddr = DEFAULT_IO_APIC_ADDR;
+	bootId = Get_Local_APIC_ID();
+	version = Get_Local_APIC_Version();
+	Add_CPU(0, version, bootId == 0);
+	Add_CPU(1, version, bootId == 1);
+	Set_ISA_IRQ_Route(0, 2, 0);
+	return true;
+    }
+
+    if (mp->configTable != 0 && Parse_MP_Config((struct MP_Config_Header*) mp->configTable))
+	return true;
+
+    Print("Bad MP configuration table\n");
+    return false;
+}
+
+/*
+ * Give a processor a data segment for its struct CPU,
+ * to be loaded into its fs register.
+ */
+static void Init_CPU_Segment(struct CPU* cpu)
+{
+    struct Segment_Descriptor* desc = Allocate_Segment_Descriptor();
+
+    KASSERT(desc != 0);
+    Init_Data_Segment_Descriptor(desc, (ulong_t) cpu, 1, KERNEL_PRIVILEGE);
+    cpu->selector = Selector(KERNEL_PRIVILEGE, true, Get_Descriptor_Index(desc));
+    cpu->self = cpu;
+}
+
+static __inline__ void Load_CPU_Segment(struct CPU* cpu)
+{
+    __asm__ __volatile__ ("movw %0, %%fs" : : "r" (cpu->selector));
+}
+
+/*
+ * Address of a trampoline field in the copy at AP_TRAMPOLINE_ADDR.
+ */
+static __inline__ ulong_t* Trampoline_Field(char* field)
+{
+    return (ulong_t*) (AP_TRAMPOLINE_ADDR + (field - &g_trampolineStart));
+}
+
+/*
+ * C entry point of an application processor, called by the
+ * trampoline code on its idle thread's stack, with interrupts disabled.
+ */
+static void AP_Main(struct CPU* cpu)
+{
+    Load_CPU_Segment(cpu);
+
+    /* Interrupts are disabled, so we need the kernel lock */
+    Lock_Kernel();
+
+    Activate_IDT();
+    Init_TSS();
+    Init_Local_APIC(false);
+    Init_AP_Perf_Counters();
+    Start_Local_APIC_Timer();
+
+    cpu->online = true;
+    Start_AP_Scheduler();
+}
+
+/*
+ * Start an application processor, following the universal
+ * startup algorithm in appendix B.4 of the MP specification.
+ * The trampoline has been installed.  Returns true if the
+ * processor came online.
+ */
+static bool Start_AP(struct CPU* cpu)
+{
+    struct Kernel_Thread* idleThread = Create_Idle_Thread();
+    bool iflag;
+    ulong_t start;
+
+    if (idleThread == 0) {
+	Print("cpu %d: no memory for an idle thread\n", cpu->id);
+	return false;
+    }
+
+    Init_CPU_Segment(cpu);
+    cpu->idleThread = cpu->currentThread = idleThread;
+    *Trampoline_Field(&g_trampolineStack) = (ulong_t) idleThread->stackPage + PAGE_SIZE;
+    *Trampoline_Field(&g_trampolineArg) = (ulong_t) cpu;
+
+    /* Processors with an external APIC start through the warm reset vector */
+    iflag = Begin_Int_Atomic();
+    Out_Byte(CMOS_ADDR_PORT, CMOS_SHUTDOWN_CODE);
+    Out_Byte(CMOS_DATA_PORT, CMOS_WARM_RESET);
+    End_Int_Atomic(iflag);
+    *((ushort_t*) WARM_RESET_VECTOR) = 0;
+    *((ushort_t*) (WARM_RESET_VECTOR + 2)) = AP_TRAMPOLINE_ADDR >> 4;
+
+    Send_IPI(cpu->apicId, IPI_INIT_ASSERT);
+    APIC_Delay(INIT_DELAY_US);
+    Send_IPI(cpu->apicId, IPI_INIT_DEASSERT);
+
+    /* Integrated APICs need startup IPIs; the spec says to send two */
+    if (cpu->apicVersion >= 0x10) {
+	int i;
+	for (i = 0; i < 2 && !cpu->online; ++i) {
+	    Send_IPI(cpu->apicId, IPI_STARTUP | (AP_TRAMPOLINE_ADDR >> 12));
+	    APIC_Delay(STARTUP_DELAY_US);
+	}
+    }
+
+    start = g_numTicks;
+    while (!cpu->online && g_numTicks - start < AP_ONLINE_TICKS)
+	__asm__ __volatile__ ("pause" : : : "memory");
+
+    iflag = Begin_Int_Atomic();
+    Out_Byte(CMOS_ADDR_PORT, CMOS_SHUTDOWN_CODE);
+    Out_Byte(CMOS_DATA_PORT, 0);
+    End_Int_Atomic(iflag);
+
+    if (cpu->online)
+	Print("cpu %d: apic id %d online\n", cpu->id, cpu->apicId);
+    else
+	Print("cpu %d: apic id %d didn't start\n", cpu->id, cpu->apicId);
+    return cpu->online;
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Set up the boot processor's per-CPU data, and find the
+ * processors in the system.  If there's no MADT or MP
+ * configuration, we have a uniprocessor.
+ */
+void Init_SMP(void)
+{
+    struct CPU* boot = &s_cpus[0];
+    struct ACPI_MADT* madt = 0;
+    struct MP_Floating_Pointer* mp = 0;
+    ulong_t eax, ebx, ecx, edx;
+    const char* source = 0;
+    int i;
+
+    KASSERT(!Interrupts_Enabled());
+
+    boot->id = 0;
+    boot->online = true;
+    Init_CPU_Segment(boot);
+    Load_CPU_Segment(boot);
+
+    s_numCPUs = 1;
+    s_localApicAddr = s_ioApicAddr = 0;
+    Init_ISA_IRQ_Routes();
+
+    Read_CPUID(1, &eax, &ebx, &ecx, &edx);
+    if (edx & CPUID_FEATURE_APIC) {
+	if ((madt = Find_MADT()) != 0) {
+	    Parse_MADT(madt);
+	    source = "ACPI";
+	} else if ((mp = Find_MP()) != 0 && Parse_MP(mp)) {
+	    source = "MP table";
+	}
+    }
+
+    if (source == 0 || s_localApicAddr == 0) {
+	Print("Uniprocessor system\n");
+	s_numCPUs = 1;
+	s_localApicAddr = s_ioApicAddr = 0;
+	return;
+    }
+
+    Print("%d processor(s) (%s), local APIC at %lx, I/O APIC at %lx\n",
+	s_numCPUs, source, s_localApicAddr, s_ioApicAddr);
+    for (i = 0; i < s_numCPUs; ++i) {
+	Print("  cpu %d: apic id %d, version %x%s\n", i, s_cpus[i].apicId,
+	    s_cpus[i].apicVersion, i == 0 ? " (boot)" : "");
+    }
+}
+
+/*
+ * Start the application processors.  Called by the initial
+ * kernel thread, once the scheduler and the timer are running.
+ * The I/O APIC takes over interrupt delivery from the PICs first,
+ * since the virtual wire mode the BIOS leaves the PICs in doesn't
+ * mix well with the other processors' local APICs.
+ */
+void Start_APs(void)
+{
+    ushort_t* gdtr;
+    int i;
+
+    if (s_numCPUs == 1)
+	return;
+
+    Init_Local_APIC(true);
+    Calibrate_Local_APIC_Timer();
+
+    if (s_ioApicAddr != 0) {
+	/*
+	 * The I/O APIC ignores an edge-triggered line that is already
+	 * raised when it unmasks it, and the UART holds its line up
+	 * until the transmit interrupt is handled.  Let the serial
+	 * output drain first, or it stops for good.
+	 */
+	Serial_Flush();
+	Disable_Interrupts();
+	if (s_imcrPresent) {
+	    Out_Byte(IMCR_SELECT_PORT, IMCR_SELECT);
+	    Out_Byte(IMCR_DATA_PORT, IMCR_APIC_MODE);
+	}
+	Switch_To_IO_APIC();
+	Enable_Interrupts();
+    }
+
+    /* Install the trampoline */
+    memcpy((void*) AP_TRAMPOLINE_ADDR, &g_trampolineStart, &g_trampolineEnd - &g_trampolineStart);
+    gdtr = (ushort_t*) Trampoline_Field(&g_trampolineGDTR);
+    Get_GDTR(gdtr);
+    *Trampoline_Field(&g_trampolineEntry) = (ulong_t) &AP_Main;
+
+    /*
+     * A processor that didn't start in time might still be
+     * on its way, so don't change the trampoline under it.
+     */
+    for (i = 1; i < s_numCPUs; ++i) {
+	if (!Start_AP(&s_cpus[i]))
+	    break;
+    }
+
+    Print("%d of %d processors online\n", Get_Num_Online_CPUs(), s_numCPUs);
+}
+
+/*
+ * Get number of processors.
+ */
+int Get_Num_CPUs(void)
+{
+    return s_numCPUs;
+}
+
+/*
+ * Get number of processors that are running threads.
+ */
+int Get_Num_Online_CPUs(void)
+{
+    int i, count = 0;
+
+    for (i = 0; i < s_numCPUs; ++i) {
+	if (s_cpus[i].online)
+	    ++count;
+    }
+    return count;
+}
+
+/*
+ * Get the per-CPU data of given processor.
+ */
+struct CPU* Get_CPU_By_Index(int cpu)
+{
+    KASSERT(cpu >= 0 && cpu < s_numCPUs);
+    return &s_cpus[cpu];
+}
+
+/*
+ * Get physical address of the local APIC registers,
+ * or 0 if there is no APIC.
+ */
+ulong_t Get_Local_APIC_Address(void)
+{
+    return s_localApicAddr;
+}
+
+/*
+ * Get physical address of the (first) I/O APIC,
+ * or 0 if there is none.
+ */
+ulong_t Get_IO_APIC_Address(void)
+{
+    return s_ioApicAddr;
+}
+
+/*
+ * Get the I/O APIC pin given ISA IRQ is connected to,
+ * or null if it isn't connected.
+ */
+const struct ISA_IRQ_Route* Get_ISA_IRQ_Route(int irq)
+{
+    KASSERT(irq >= 0 && irq < 16);
+    return s_isaRouted[irq] ? &s_isaRoutes[irq] : 0;
+}
@@ -11,6 +11,11 @@
 #include <geekos/int.h>
 #include <geekos/kassert.h>
 #include <geekos/screen.h>
+#include <geekos/string.h>
+#include <geekos/cpu.h>
+#include <geekos/timer.h>
+#include <geekos/trace.h>
+#include <geekos/backtrace.h>
 #include <geekos/synch.h>
 
 /*
@@ -20,78 +25,235 @@
  * - Unlike disabling interrupts, mutexes offer NO protection against
  *   concurrent execution of interrupt handlers.  Mutexes and
  *   condition variables should only be used from kernel threads,
- *   with interrupts enabled.
+ *   with interrupts enabled.  Their own state is protected by
+ *   disabling interrupts, which takes the kernel lock.
+ * - Reader-writer locks and semaphores are implemented directly on
+ *   wait queues, with interrupts disabled.  Sem_V() may be called
+ *   from an interrupt handler.
  */
 
 /* ----------------------------------------------------------------------
- * Private functions
+ * Private data and functions
  * ---------------------------------------------------------------------- */
 
+IMPLEMENT_LIST(Mutex_List, Mutex);
+
+/*
+ * Mutexes registered for statistics reporting.
+ */
+static struct Mutex_List s_mutexList;
+
+bool g_waitMorphing = true;
+
+/*
+ * Cond_Broadcast() statistics: number of broadcasts, and
+ * how many waiters were woken or moved to a mutex wait queue.
+ */
+static ulong_t s_numBroadcasts, s_numBroadcastWakeups, s_numBroadcastMorphs;
+
+/*
+ * Limit on the length of a chain of threads blocked on mutexes
+ * that priority inheritance will follow.  This keeps a deadlock
+ * cycle from hanging the kernel.
+ */
+#define MAX_INHERITANCE_DEPTH 8
+
+/*
+ * A thread of given priority is about to wait for given mutex.
+ * Raise the owner's priority to match; if the owner is itself
+ * waiting for a mutex, pass the boost along to that mutex's owner,
+ * and so on.  Must be called with interrupts disabled.
+ */
+static void Inherit_Priority(struct Mutex* mutex, int priority)
+{
+    int depth;
+
+    KASSERT(!Interrupts_Enabled());
+
+    for (depth = 0; mutex != 0 && depth < MAX_INHERITANCE_DEPTH; ++depth) {
+	struct Kernel_Thread* owner = mutex->owner;
+
+	if (owner == 0 || owner->priority >= priority)
+	    break;
+
+	++mutex->stats.boosts;
+	Set_Effective_Priority(owner, priority);
+	mutex = owner->blockedOn;
+    }
+}
+
+/*
+ * Compute the priority given thread should have: its base
+ * priority, or that of the highest priority thread waiting
+ * for a mutex it holds, whichever is higher.
+ * Interrupts must be disabled.
+ */
+static int Inherited_Priority(struct Kernel_Thread* kthread)
+{
+    int priority = kthread->basePriority;
+    struct Mutex* mutex;
+
+    for (mutex = Get_Front_Of_Held_Mutex_List(&kthread->heldMutexes); mutex != 0;
+	 mutex = Get_Next_In_Held_Mutex_List(mutex)) {
+	struct Kernel_Thread* waiter;
+
+	for (waiter = Get_Front_Of_Thread_Queue(&mutex->waitQueue); waiter != 0;
+	     waiter = Get_Next_In_Thread_Queue(waiter)) {
+	    if (waiter->priority > priority)
+		priority = waiter->priority;
+	}
+    }
+
+    return priority;
+}
+
 /*
  * The mutex is currently locked.
- * Atomically reenable preemption and wait in the
- * mutex's wait queue.
+ * Lend our priority to the owner, then wait in the mutex's
+ * wait queue.  Interrupts must be disabled.
  */
 static void Mutex_Wait(struct Mutex *mutex)
 {
+    struct Kernel_Thread* current = g_currentThread;
+
     KASSERT(mutex->state == MUTEX_LOCKED);
-    KASSERT(g_preemptionDisabled);
+    KASSERT(!Interrupts_Enabled());
 
-    Disable_Interrupts();
-    g_preemptionDisabled = false;
+    current->blockedOn = mutex;
+    Inherit_Priority(mutex, current->priority);
     Wait(&mutex->waitQueue);
-    g_preemptionDisabled = true;
-    Enable_Interrupts();
+    current->blockedOn = 0;
+}
+
+/*
+ * Number of times to check a mutex whose owner is running
+ * on another processor before giving up on one spin.
+ */
+#define MUTEX_SPIN_LIMIT 2000
+
+/*
+ * The mutex is currently locked.
+ * Critical sections are usually short, so rather than going
+ * to sleep right away, give the owner a few chances to finish
+ * and release the mutex: waiting for it is much cheaper than
+ * a trip through the wait queue.  If the owner is running on
+ * another processor, spin (with interrupts enabled, so the
+ * owner can get the kernel lock) until it releases the mutex.
+ * Otherwise yield to it, which only helps while the owner is
+ * runnable and the scheduling policy would run it before us;
+ * if it's asleep, we might as well sleep too.
+ * Interrupts must be disabled.
+ */
+static void Mutex_Yield_To_Owner(struct Mutex* mutex)
+{
+    int i;
+
+    KASSERT(!Interrupts_Enabled());
+
+    for (i = 0; i < mutex->maxYields && mutex->state == MUTEX_LOCKED; ++i) {
+	if (Is_Thread_Running(mutex->owner)) {
+	    int spins;
+
+	    ++mutex->stats.spins;
+	    Enable_Interrupts();
+	    for (spins = 0; spins < MUTEX_SPIN_LIMIT && mutex->state == MUTEX_LOCKED; ++spins)
+		__asm__ __volatile__ ("pause" : : : "memory");
+	    Disable_Interrupts();
+	} else if (Runs_Ahead_Of_Current(mutex->owner)) {
+	    ++mutex->stats.yields;
+	    Make_Runnable(g_currentThread);
+	    Schedule();
+	} else {
+	    break;
+	}
+    }
 }
 
 /*
  * Lock given mutex.
- * Preemption must be disabled.
+ * Interrupts must be disabled.
  */
 static __inline__ void Mutex_Lock_Imp(struct Mutex* mutex)
 {
-    KASSERT(g_preemptionDisabled);
+    ulong_t waited = 0;
+
+    KASSERT(!Interrupts_Enabled());
 
     /* Make sure we're not already holding the mutex */
     KASSERT(!IS_HELD(mutex));
 
-    /* Wait until the mutex is in an unlocked state */
-    while (mutex->state == MUTEX_LOCKED) {
-	Mutex_Wait(mutex);
+    ++mutex->stats.acquisitions;
+
+    if (mutex->state == MUTEX_LOCKED) {
+	ulong_t start = Read_TSC();
+
+	++mutex->stats.contended;
+	Mutex_Yield_To_Owner(mutex);
+
+	/* Wait until the mutex is in an unlocked state */
+	while (mutex->state == MUTEX_LOCKED) {
+	    ++mutex->stats.sleeps;
+	    Mutex_Wait(mutex);
+	}
+
+	waited = Read_TSC() - start;
+	mutex->stats.waitCycles += waited;
+	if (waited > mutex->stats.maxWaitCycles) {
+	    ulong_t* stack = mutex->stats.maxWaitStack;
+	    int depth = Get_Current_Backtrace(stack, MUTEX_STACK_DEPTH);
+
+	    memset(&stack[depth], '\0', (MUTEX_STACK_DEPTH - depth) * sizeof(ulong_t));
+	    mutex->stats.maxWaitCycles = waited;
+	}
     }
 
     /* Now it's ours! */
     mutex->state = MUTEX_LOCKED;
     mutex->owner = g_currentThread;
+    mutex->lockTSC = Read_TSC();
+    Add_To_Back_Of_Held_Mutex_List(&g_currentThread->heldMutexes, mutex);
+    TRACE(TRACE_MUTEX_LOCK, mutex, waited);
 }
 
 /*
  * Unlock given mutex.
- * Preemption must be disabled.
+ * Interrupts must be disabled.
+ * Returns true if a thread that outranks the current thread
+ * was woken, in which case the caller should yield to it.
  */
-static __inline__ void Mutex_Unlock_Imp(struct Mutex* mutex)
+static __inline__ bool Mutex_Unlock_Imp(struct Mutex* mutex)
 {
-    KASSERT(g_preemptionDisabled);
+    struct Kernel_Thread* current = g_currentThread;
+    struct Kernel_Thread* woken = 0;
+    ulong_t held;
+
+    KASSERT(!Interrupts_Enabled());
 
     /* Make sure mutex was actually acquired by this thread. */
     KASSERT(IS_HELD(mutex));
 
+    TRACE(TRACE_MUTEX_UNLOCK, mutex, 0);
+
+    held = Read_TSC() - mutex->lockTSC;
+    if (held > mutex->stats.maxHoldCycles)
+	mutex->stats.maxHoldCycles = held;
+
     /* Unlock the mutex. */
     mutex->state = MUTEX_UNLOCKED;
     mutex->owner = 0;
+    Remove_From_Held_Mutex_List(&current->heldMutexes, mutex);
 
     /*
      * If there are threads waiting to acquire the mutex,
-     * wake one of them up.  Note that it is legal to inspect
-     * the queue with interrupts enabled because preemption
-     * is disabled, and therefore we know that no thread can
-     * concurrently add itself to the queue.
+     * wake one of them up.  If we were running at a priority
+     * inherited from a waiter, drop back to whatever the mutexes
+     * we still hold call for.
      */
-    if (!Is_Thread_Queue_Empty(&mutex->waitQueue)) {
-	Disable_Interrupts();
-	Wake_Up_One(&mutex->waitQueue);
-	Enable_Interrupts();
-    }
+    if (current->priority != current->basePriority)
+	Set_Effective_Priority(current, Inherited_Priority(current));
+    woken = Wake_Up_One(&mutex->waitQueue);
+
+    return woken != 0 && woken->priority > current->priority;
 }
 
 /* ----------------------------------------------------------------------
@@ -106,6 +268,10 @@ void Mutex_Init(struct Mutex* mutex)
     mutex->state = MUTEX_UNLOCKED;
     mutex->owner = 0;
     Clear_Thread_Queue(&mutex->waitQueue);
+    mutex->maxYields = MUTEX_DEFAULT_YIELDS;
+    mutex->lockTSC = 0;
+    memset(&mutex->stats, '\0', sizeof(mutex->stats));
+    mutex->name = 0;
 }
 
 /*
@@ -115,9 +281,9 @@ void Mutex_Lock(struct Mutex* mutex)
 {
     KASSERT(Interrupts_Enabled());
 
-    g_preemptionDisabled = true;
+    Disable_Interrupts();
     Mutex_Lock_Imp(mutex);
-    g_preemptionDisabled = false;
+    Enable_Interrupts();
 }
 
 /*
@@ -125,11 +291,109 @@ void Mutex_Lock(struct Mutex* mutex)
  */
 void Mutex_Unlock(struct Mutex* mutex)
 {
+    bool preempt;
+
     KASSERT(Interrupts_Enabled());
 
-    g_preemptionDisabled = true;
-    Mutex_Unlock_Imp(mutex);
-    g_preemptionDisabled = false;
+    Disable_Interrupts();
+    preempt = Mutex_Unlock_Imp(mutex);
+    Enable_Interrupts();
+
+    /*
+     * Let a higher priority waiter (perhaps the one whose
+     * priority we inherited) run right away.
+     */
+    if (preempt)
+	Yield();
+}
+
+/*
+ * Set the number of times a thread trying to lock given mutex
+ * will yield to (or spin waiting for) the owner before sleeping.
+ * Zero means always sleep right away.
+ */
+void Mutex_Set_Max_Yields(struct Mutex* mutex, int maxYields)
+{
+    KASSERT(maxYields >= 0);
+    mutex->maxYields = maxYields;
+}
+
+/*
+ * Give a mutex a name, and include it in the
+ * output of Dump_Lock_Stats().
+ */
+void Mutex_Register(struct Mutex* mutex, const char* name)
+{
+    bool iflag;
+
+    KASSERT(mutex->name == 0);
+    mutex->name = name;
+
+    iflag = Begin_Int_Atomic();
+    Add_To_Back_Of_Mutex_List(&s_mutexList, mutex);
+    End_Int_Atomic(iflag);
+}
+
+/*
+ * Remove a registered mutex from the list of mutexes
+ * reported by Dump_Lock_Stats().  Must be done
+ * before the memory containing the mutex is freed.
+ */
+void Mutex_Unregister(struct Mutex* mutex)
+{
+    bool iflag;
+
+    KASSERT(mutex->name != 0);
+
+    iflag = Begin_Int_Atomic();
+    Remove_From_Mutex_List(&s_mutexList, mutex);
+    End_Int_Atomic(iflag);
+
+    mutex->name = 0;
+}
+
+/*
+ * Print contention statistics for all registered mutexes.
+ * For contended ones, also print the return addresses leading
+ * to the longest wait; scripts/eipToFunction can name them.
+ */
+void Dump_Lock_Stats(void)
+{
+    struct Mutex* mutex;
+    bool iflag;
+
+    Print("%-8s %7s %7s %7s %7s %7s %7s %9s %9s %9s\n",
+	"lock", "acquire", "contend", "yield", "spin", "sleep", "boost",
+	"avg wait", "max wait", "max hold");
+
+    iflag = Begin_Int_Atomic();
+    for (mutex = Get_Front_Of_Mutex_List(&s_mutexList); mutex != 0;
+	 mutex = Get_Next_In_Mutex_List(mutex)) {
+	struct Mutex_Stats* stats = &mutex->stats;
+	ulong_t avgWait = 0;
+
+	if (stats->contended != 0)
+	    avgWait = Divide_64((ulong_t) (stats->waitCycles >> 32),
+		(ulong_t) stats->waitCycles, stats->contended);
+
+	Print("%-8s %7lu %7lu %7lu %7lu %7lu %7lu %9lu %9lu %9lu\n",
+	    mutex->name, stats->acquisitions, stats->contended,
+	    stats->yields, stats->spins, stats->sleeps, stats->boosts,
+	    avgWait, stats->maxWaitCycles, stats->maxHoldCycles);
+	if (stats->contended != 0) {
+	    int i;
+
+	    Print("         longest wait from");
+	    for (i = 0; i < MUTEX_STACK_DEPTH && stats->maxWaitStack[i] != 0; ++i)
+		Print(" %lx", stats->maxWaitStack[i]);
+	    Print("\n");
+	}
+    }
+    End_Int_Atomic(iflag);
+
+    Print("%lu broadcasts: %lu waiters woken, %lu moved to mutex (morphing %s)\n",
+	s_numBroadcasts, s_numBroadcastWakeups, s_numBroadcastMorphs,
+	g_waitMorphing ? "on" : "off");
 }
 
 /*
@@ -138,6 +402,7 @@ void Mutex_Unlock(struct Mutex* mutex)
 void Cond_Init(struct Condition* cond)
 {
     Clear_Thread_Queue(&cond->waitQueue);
+    cond->mutex = 0;
 }
 
 /*
@@ -150,35 +415,32 @@ void Cond_Wait(struct Condition* cond, struct Mutex* mutex)
     /* Ensure mutex is held. */
     KASSERT(IS_HELD(mutex));
 
-    /* Turn off scheduling. */
-    g_preemptionDisabled = true;
+    Disable_Interrupts();
+
+    /* Remember the mutex, so Cond_Broadcast() can move us to its wait queue. */
+    cond->mutex = mutex;
 
     /*
-     * Release the mutex, but leave preemption disabled.
-     * No other threads will be able to run before this thread
-     * is able to wait.  Therefore, this thread will not
-     * miss the eventual notification on the condition.
+     * Release the mutex, but leave interrupts disabled.
+     * No other thread will be able to signal the condition
+     * before this thread is able to wait.  Therefore, this thread
+     * will not miss the eventual notification on the condition.
      */
     Mutex_Unlock_Imp(mutex);
 
     /*
-     * Atomically reenable preemption and wait in the condition wait queue.
+     * Wait in the condition wait queue.
      * Other threads can run while this thread is waiting,
      * and eventually one of them will call Cond_Signal() or Cond_Broadcast()
      * to wake up this thread.
-     * On wakeup, disable preemption again.
      */
-    Disable_Interrupts();
-    g_preemptionDisabled = false;
     Wait(&cond->waitQueue);
-    g_preemptionDisabled = true;
-    Enable_Interrupts();
+    g_currentThread->blockedOn = 0;
 
     /* Reacquire the mutex. */
     Mutex_Lock_Imp(mutex);
 
-    /* Turn scheduling back on. */
-    g_preemptionDisabled = false;
+    Enable_Interrupts();
 }
 
 /*
@@ -196,11 +458,205 @@ void Cond_Signal(struct Condition* cond)
 /*
  * Wake up all threads waiting on the given condition.
  * The mutex guarding the condition should be held!
+ *
+ * Since the mutex is held, waking the waiters would just send
+ * them into Mutex_Lock_Imp() to go back to sleep one after another.
+ * Instead, move them directly to the mutex's wait queue ("wait
+ * morphing"); Mutex_Unlock() then wakes them one at a time.
  */
 void Cond_Broadcast(struct Condition* cond)
 {
+    struct Mutex* mutex = cond->mutex;
+
     KASSERT(Interrupts_Enabled());
     Disable_Interrupts();  /* prevent scheduling */
-    Wake_Up(&cond->waitQueue);
+
+    ++s_numBroadcasts;
+    if (g_waitMorphing && mutex != 0 && mutex->state == MUTEX_LOCKED) {
+	while (!Is_Thread_Queue_Empty(&cond->waitQueue)) {
+	    struct Kernel_Thread* kthread = Remove_From_Front_Of_Thread_Queue(&cond->waitQueue);
+
+	    Enqueue_Thread(&mutex->waitQueue, kthread);
+	    kthread->blockedOn = mutex;
+	    Inherit_Priority(mutex, kthread->priority);
+	    ++s_numBroadcastMorphs;
+	}
+    } else {
+	struct Kernel_Thread* kthread;
+
+	for (kthread = Get_Front_Of_Thread_Queue(&cond->waitQueue); kthread != 0;
+	     kthread = Get_Next_In_Thread_Queue(kthread))
+	    ++s_numBroadcastWakeups;
+	Wake_Up(&cond->waitQueue);
+    }
+
     Enable_Interrupts();  /* resume scheduling */
 }
+
+/*
+ * Initialize given reader-writer lock.
+ */
+void RWLock_Init(struct RWLock* rwlock)
+{
+    rwlock->readers = 0;
+    rwlock->writer = false;
+    rwlock->waitingWriters = 0;
+    Clear_Thread_Queue(&rwlock->readQueue);
+    Clear_Thread_Queue(&rwlock->writeQueue);
+}
+
+/*
+ * Acquire given reader-writer lock for reading.
+ */
+void Read_Lock(struct RWLock* rwlock)
+{
+    KASSERT(Interrupts_Enabled());
+    Disable_Interrupts();
+
+    /* Don't jump ahead of a waiting writer */
+    while (rwlock->writer || rwlock->waitingWriters > 0)
+	Wait(&rwlock->readQueue);
+    ++rwlock->readers;
+
+    Enable_Interrupts();
+}
+
+/*
+ * Release given reader-writer lock, held for reading.
+ */
+void Read_Unlock(struct RWLock* rwlock)
+{
+    KASSERT(Interrupts_Enabled());
+    Disable_Interrupts();
+
+    KASSERT(rwlock->readers > 0);
+    if (--rwlock->readers == 0 && rwlock->waitingWriters > 0)
+	Wake_Up_One(&rwlock->writeQueue);
+
+    Enable_Interrupts();
+}
+
+/*
+ * Acquire given reader-writer lock for writing.
+ */
+void Write_Lock(struct RWLock* rwlock)
+{
+    KASSERT(Interrupts_Enabled());
+    Disable_Interrupts();
+
+    ++rwlock->waitingWriters;
+    while (rwlock->writer || rwlock->readers > 0)
+	Wait(&rwlock->writeQueue);
+    --rwlock->waitingWriters;
+    rwlock->writer = true;
+
+    Enable_Interrupts();
+}
+
+/*
+ * Release given reader-writer lock, held for writing.
+ * The next waiting writer gets the lock if there is one;
+ * otherwise all waiting readers are woken as a batch.
+ */
+void Write_Unlock(struct RWLock* rwlock)
+{
+    KASSERT(Interrupts_Enabled());
+    Disable_Interrupts();
+
+    KASSERT(rwlock->writer);
+    rwlock->writer = false;
+    if (rwlock->waitingWriters > 0)
+	Wake_Up_One(&rwlock->writeQueue);
+    else
+	Wake_Up(&rwlock->readQueue);
+
+    Enable_Interrupts();
+}
+
+/*
+ * Initialize given semaphore with given count.
+ */
+void Sem_Init(struct Semaphore* sem, int count)
+{
+    KASSERT(count >= 0);
+    sem->count = count;
+    Clear_Thread_Queue(&sem->waitQueue);
+}
+
+/*
+ * Decrement given semaphore, waiting until
+ * its count is positive if necessary.
+ */
+void Sem_P(struct Semaphore* sem)
+{
+    KASSERT(Interrupts_Enabled());
+    Disable_Interrupts();
+
+    while (sem->count == 0)
+	Wait(&sem->waitQueue);
+    --sem->count;
+
+    Enable_Interrupts();
+}
+
+/*
+ * Decrement given semaphore if its count is positive.
+ * Returns true if successful, false if the count was zero.
+ */
+bool Sem_Try_P(struct Semaphore* sem)
+{
+    bool iflag, acquired = false;
+
+    iflag = Begin_Int_Atomic();
+    if (sem->count > 0) {
+	--sem->count;
+	acquired = true;
+    }
+    End_Int_Atomic(iflag);
+
+    return acquired;
+}
+
+/*
+ * Decrement given semaphore, waiting at most given number
+ * of timer ticks for its count to become positive.
+ * Returns true if successful, false if the wait timed out.
+ */
+bool Sem_Timed_P(struct Semaphore* sem, ulong_t ticks)
+{
+    ulong_t deadline;
+    bool acquired = false;
+
+    KASSERT(Interrupts_Enabled());
+    Disable_Interrupts();
+
+    deadline = g_numTicks + ticks;
+    while (sem->count == 0) {
+	long remaining = (long) (deadline - g_numTicks);
+	if (remaining <= 0 || !Wait_Timeout(&sem->waitQueue, remaining))
+	    break;
+    }
+
+    if (sem->count > 0) {
+	--sem->count;
+	acquired = true;
+    }
+
+    Enable_Interrupts();
+
+    return acquired;
+}
+
+/*
+ * Increment given semaphore, waking up a waiting thread
+ * if there is one.
+ */
+void Sem_V(struct Semaphore* sem)
+{
+    bool iflag = Begin_Int_Atomic();
+
+    ++sem->count;
+    Wake_Up_One(&sem->waitQueue);
+
+    End_Int_Atomic(iflag);
+}
@@ -0,0 +1,102 @@
+/*
+ * Deferred interrupt work (tasklets)
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/int.h>
+#include <geekos/kthread.h>
+#include <geekos/tasklet.h>
+
+/* ----------------------------------------------------------------------
+ * Private data
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Tasklets waiting to run, in the order they were scheduled.
+ * Only accessed with interrupts disabled.
+ */
+static struct Tasklet_List s_pendingList;
+
+/*
+ * Set while Run_Tasklets() is draining the pending list,
+ * so that interrupts arriving in the meantime don't
+ * start another (nested) round.
+ */
+static bool s_runningTasklets;
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Initialize a tasklet which will call given function
+ * with given argument.
+ */
+void Init_Tasklet(struct Tasklet* tasklet, Tasklet_Func func, ulong_t arg)
+{
+    tasklet->func = func;
+    tasklet->arg = arg;
+    tasklet->pending = false;
+}
+
+/*
+ * Arrange for given tasklet to run when the current interrupt
+ * returns.  Scheduling a tasklet that is already pending
+ * has no effect.  Must be called with interrupts disabled!
+ */
+void Schedule_Tasklet(struct Tasklet* tasklet)
+{
+    KASSERT(!Interrupts_Enabled());
+
+    if (!tasklet->pending) {
+	tasklet->pending = true;
+	Add_To_Back_Of_Tasklet_List(&s_pendingList, tasklet);
+    }
+}
+
+/*
+ * Run all pending tasklets.
+ * Called by Handle_Interrupt (in lowlevel.asm) with interrupts
+ * disabled, after the C handler has returned.  Interrupts are enabled
+ * while each tasklet runs, and preemption is disabled so that
+ * the interrupted thread (on whose stack we are running)
+ * can't be switched out from under us.  If a tasklet asks
+ * for a reschedule, it happens when the interrupt returns.
+ */
+void Run_Tasklets(struct Interrupt_State* state)
+{
+    int preemptionDisabled;
+
+    KASSERT(!Interrupts_Enabled());
+
+    if (s_runningTasklets || Is_Tasklet_List_Empty(&s_pendingList))
+	return;
+
+    /*
+     * If the interrupted code had interrupts disabled
+     * (e.g., a processor exception in an atomic region),
+     * we can't enable them here; leave the tasklets for
+     * the next interrupt.
+     */
+    if ((state->eflags & EFLAGS_IF) == 0)
+	return;
+
+    s_runningTasklets = true;
+    preemptionDisabled = g_preemptionDisabled;
+    g_preemptionDisabled = true;
+
+    while (!Is_Tasklet_List_Empty(&s_pendingList)) {
+	struct Tasklet* tasklet = Remove_From_Front_Of_Tasklet_List(&s_pendingList);
+	tasklet->pending = false;
+
+	Enable_Interrupts();
+	tasklet->func(tasklet->arg);
+	Disable_Interrupts();
+    }
+
+    g_preemptionDisabled = preemptionDisabled;
+    s_runningTasklets = false;
+}
@@ -13,6 +13,8 @@
 #include <geekos/int.h>
 #include <geekos/irq.h>
 #include <geekos/kthread.h>
+#include <geekos/profile.h>
+#include <geekos/cpu.h>
 #include <geekos/timer.h>
 
 
@@ -26,6 +28,13 @@ volatile ulong_t g_numTicks;
  */
 static int s_spinCountPerTick;
 
+/*
+ * Number of TSC cycles per timer tick, measured along with
+ * the delay loop, and the time stamp the measurement started at.
+ */
+static ulong_t s_cyclesPerTick;
+static ulong_t s_calibrateTSC;
+
 /*
  * Number of ticks to wait before calibrating the delay loop.
  */
@@ -61,23 +70,14 @@ int g_Quantum = DEFAULT_MAX_TICKS;
 
 static void Timer_Interrupt_Handler(struct Interrupt_State* state)
 {
-    struct Kernel_Thread* current = g_currentThread;
-
     Begin_IRQ(state);
 
-    /* Update global and per-thread number of ticks */
+    /* Update global number of ticks, and charge the tick to the thread */
     ++g_numTicks;
-    ++current->numTicks;
-
+    Charge_Timer_Tick(state);
 
-    /*
-     * If thread has been running for an entire quantum,
-     * inform the interrupt return code that we want
-     * to choose a new thread.
-     */
-    if (current->numTicks >= g_Quantum) {
-	g_needReschedule = true;
-    }
+    /* Wake up threads whose timed waits have run out. */
+    Wake_Expired_Timeouts();
 
 
     End_IRQ(state);
@@ -90,15 +90,17 @@ static void Timer_Interrupt_Handler(struct Interrupt_State* state)
 static void Timer_Calibrate(struct Interrupt_State* state)
 {
     Begin_IRQ(state);
-    if (g_numTicks < CALIBRATE_NUM_TICKS)
-	++g_numTicks;
-    else {
+    if (g_numTicks < CALIBRATE_NUM_TICKS) {
+	if (++g_numTicks == CALIBRATE_NUM_TICKS)
+	    s_calibrateTSC = Read_TSC();
+    } else {
 	/*
 	 * Now we can look at EAX, which reflects how many times
 	 * the loop has executed
 	 */
 	/*Print("Timer_Calibrate: eax==%d\n", state->eax);*/
 	s_spinCountPerTick = INT_MAX  - state->eax;
+	s_cyclesPerTick = Read_TSC() - s_calibrateTSC;
 	state->eax = 0;  /* make the loop terminate */
     }
     End_IRQ(state);
@@ -168,6 +170,30 @@ static void Calibrate_Delay(void)
  * Public functions
  * ---------------------------------------------------------------------- */
 
+/*
+ * Charge a timer tick to the thread running on this processor.
+ * Called from the timer interrupt handler of each processor:
+ * the PIT on the boot processor, the local APIC timer on the others.
+ */
+void Charge_Timer_Tick(struct Interrupt_State* state)
+{
+    struct Kernel_Thread* current = g_currentThread;
+
+    ++current->numTicks;
+
+    /* Take a profile sample, if one is due */
+    Profile_Tick(state);
+
+    /*
+     * If thread has been running for an entire quantum,
+     * inform the interrupt return code that we want
+     * to choose a new thread.
+     */
+    if (current->numTicks >= g_Quantum) {
+	g_needReschedule = true;
+    }
+}
+
 void Init_Timer(void)
 {
     /*
@@ -211,3 +237,14 @@ void Micro_Delay(int us)
 
     Spin(numSpins);
 }
+
+/*
+ * Convert a number of TSC cycles to microseconds.
+ * Only usable after Init_Timer().
+ */
+ulong_t Cycles_To_Us(ulong_t cycles)
+{
+    ulong_t cyclesPerUs = s_cyclesPerTick / US_PER_PIT_TICK;
+
+    return cycles / (cyclesPerUs != 0 ? cyclesPerUs : 1);
+}
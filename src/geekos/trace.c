@@ -0,0 +1,54 @@
+/*
+ * Kernel event tracing
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/screen.h>
+#include <geekos/serial.h>
+#include <geekos/trace.h>
+
+/* ----------------------------------------------------------------------
+ * Public data and functions
+ * ---------------------------------------------------------------------- */
+
+struct Trace_Record g_traceBuffer[TRACE_BUFFER_SIZE];
+volatile ulong_t g_traceNext;
+volatile bool g_traceEnabled = true;
+
+/*
+ * Write the contents of the trace buffer to the serial port,
+ * oldest record first, one line per record:
+ *
+ *   T <seq> <tsc> <event> <cpu> <a> <b>
+ *
+ * with all fields in hex.  Use scripts/decodetrace to turn
+ * this into a readable timeline.  Tracing is paused while
+ * the dump is in progress, since it can take a while.
+ */
+void Dump_Trace(void)
+{
+    ulong_t first, last, seq;
+
+    if (!Serial_Present()) {
+	Print("No serial port for trace dump\n");
+	return;
+    }
+
+    g_traceEnabled = false;
+
+    last = g_traceNext;
+    first = (last > TRACE_BUFFER_SIZE) ? last - TRACE_BUFFER_SIZE : 0;
+
+    Print("Dumping %lu trace records to serial port\n", last - first);
+    Serial_Print("TRACE-BEGIN %lu\n", last - first);
+    for (seq = first; seq != last; ++seq) {
+	struct Trace_Record* rec = &g_traceBuffer[seq & TRACE_BUFFER_MASK];
+	Serial_Print("T %lx %lx %x %x %lx %lx\n",
+	    seq, rec->tsc, rec->event, rec->cpu, rec->a, rec->b);
+    }
+    Serial_Print("TRACE-END\n");
+
+    g_traceEnabled = true;
+}
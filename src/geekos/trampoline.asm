@@ -0,0 +1,84 @@
+; Startup code for the application processors
+;
+; This is free software.  You are permitted to use,
+; redistribute, and modify it as specified in the file "COPYING".
+
+; An application processor starts in real mode, at the page
+; given by the startup IPI.  Start_APs() (in smp.c) copies this
+; code to AP_TRAMPOLINE_ADDR, and fills in the data at the end:
+; the GDTR contents, and the stack, argument and address of
+; the C function the processor calls once it is in protected mode.
+; Everything here must be position independent, or computed
+; relative to AP_TRAMPOLINE_ADDR.
+
+%include "defs.asm"
+%include "symbol.asm"
+
+EXPORT g_trampolineStart
+EXPORT g_trampolineEnd
+EXPORT g_trampolineGDTR
+EXPORT g_trampolineStack
+EXPORT g_trampolineArg
+EXPORT g_trampolineEntry
+
+; Address of a label in the copy of the code at AP_TRAMPOLINE_ADDR
+%define TRAMPOLINE_ADDR(label) (AP_TRAMPOLINE_ADDR + ((label) - g_trampolineStart))
+
+[SECTION .text]
+[BITS 16]
+
+align 16
+g_trampolineStart:
+	cli
+	cld
+
+	; The startup IPI set cs to the segment of AP_TRAMPOLINE_ADDR
+	mov	ax, cs
+	mov	ds, ax
+
+	; Load the kernel GDT
+	o32 lgdt [g_trampolineGDTR - g_trampolineStart]
+
+	; Enter protected mode, with caching enabled
+	mov	eax, cr0
+	and	eax, 0x9fffffff		; clear CD and NW
+	or	eax, 1			; set PE
+	mov	cr0, eax
+
+	; Jump to 32 bit code, loading cs
+	jmp	dword KERNEL_CS:TRAMPOLINE_ADDR(.protected)
+
+[BITS 32]
+.protected:
+	mov	ax, KERNEL_DS
+	mov	ds, ax
+	mov	es, ax
+	mov	fs, ax
+	mov	gs, ax
+	mov	ss, ax
+
+	; Switch to the stack we were given, and call the entry function
+	mov	esp, [TRAMPOLINE_ADDR(g_trampolineStack)]
+	push	dword [TRAMPOLINE_ADDR(g_trampolineArg)]
+	call	dword [TRAMPOLINE_ADDR(g_trampolineEntry)]
+
+	; The entry function shouldn't return
+.halt:
+	hlt
+	jmp	.halt
+
+; 16 bit limit and 32 bit base address of the kernel GDT
+align 4
+g_trampolineGDTR:
+	dw	0
+	dd	0
+
+align 4
+g_trampolineStack:
+	dd	0
+g_trampolineArg:
+	dd	0
+g_trampolineEntry:
+	dd	0
+
+g_trampolineEnd:
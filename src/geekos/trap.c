@@ -11,6 +11,7 @@
 #include <geekos/kthread.h>
 #include <geekos/defs.h>
 #include <geekos/trap.h>
+#include <geekos/backtrace.h>
 
 /*
  * TODO: need to add handlers for other exceptions (such as bounds
@@ -27,6 +28,7 @@ static void GPF_Handler(struct Interrupt_State* state)
     Print("Exception %d received, killing thread %p\n",
 	state->intNum, g_currentThread);
     Dump_Interrupt_State(state);
+    Print_Backtrace(state->ebp);
 
     Exit(-1);
 
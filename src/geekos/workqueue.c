@@ -0,0 +1,187 @@
+/*
+ * Kernel work queues
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <geekos/kassert.h>
+#include <geekos/screen.h>
+#include <geekos/malloc.h>
+#include <geekos/kthread.h>
+#include <geekos/synch.h>
+#include <geekos/workqueue.h>
+
+/* ----------------------------------------------------------------------
+ * Private data and functions
+ * ---------------------------------------------------------------------- */
+
+#define SYSTEM_WORK_QUEUE_WORKERS 2
+
+/*
+ * Body of a worker thread.
+ * Repeatedly takes the oldest item off the queue and runs it,
+ * until the queue is shut down and empty.
+ */
+static void Worker_Thread(ulong_t arg)
+{
+    struct Work_Queue* queue = (struct Work_Queue*) arg;
+
+    Mutex_Lock(&queue->lock);
+    for (;;) {
+	struct Work_Item* work;
+
+	while (Is_Work_List_Empty(&queue->pendingList) && !queue->shutdown)
+	    Cond_Wait(&queue->workAvailable, &queue->lock);
+
+	if (Is_Work_List_Empty(&queue->pendingList))
+	    break;
+
+	work = Remove_From_Front_Of_Work_List(&queue->pendingList);
+
+	/* Run the work function without holding the queue lock. */
+	Mutex_Unlock(&queue->lock);
+	work->func(work->arg);
+	Mutex_Lock(&queue->lock);
+
+	/*
+	 * The item may be reused (or freed) by its owner as soon as
+	 * it's marked done, so don't touch it after the broadcast.
+	 */
+	work->pending = false;
+	++queue->numCompleted;
+	Cond_Broadcast(&work->done);
+    }
+    Mutex_Unlock(&queue->lock);
+
+    Exit(0);
+}
+
+/* ----------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+struct Work_Queue* g_systemWorkQueue;
+
+/*
+ * Create the system work queue.
+ */
+void Init_Work_Queues(void)
+{
+    g_systemWorkQueue = Create_Work_Queue("system", SYSTEM_WORK_QUEUE_WORKERS, PRIORITY_LOW);
+    if (g_systemWorkQueue == 0)
+	Print("Could not create system work queue!\n");
+}
+
+/*
+ * Create a work queue served by given number of worker threads,
+ * which run at given priority.  Returns null if the queue
+ * or its threads could not be created.  Only the calling thread
+ * may destroy the queue.
+ */
+struct Work_Queue* Create_Work_Queue(const char* name, int numWorkers, int priority)
+{
+    struct Work_Queue* queue;
+    int i;
+
+    KASSERT(numWorkers > 0);
+
+    queue = (struct Work_Queue*) Malloc(sizeof(*queue));
+    if (queue == 0)
+	return 0;
+    queue->workers = (struct Kernel_Thread**) Malloc(numWorkers * sizeof(struct Kernel_Thread*));
+    if (queue->workers == 0) {
+	Free(queue);
+	return 0;
+    }
+
+    queue->name = name;
+    queue->priority = priority;
+    queue->numWorkers = 0;
+    Mutex_Init(&queue->lock);
+    Mutex_Register(&queue->lock, name);
+    Cond_Init(&queue->workAvailable);
+    Clear_Work_List(&queue->pendingList);
+    queue->shutdown = false;
+    queue->numQueued = queue->numCompleted = 0;
+
+    for (i = 0; i < numWorkers; ++i) {
+	struct Kernel_Thread* worker = Start_Kernel_Thread(Worker_Thread, (ulong_t) queue, priority, false);
+	if (worker == 0) {
+	    Destroy_Work_Queue(queue);
+	    return 0;
+	}
+	queue->workers[queue->numWorkers++] = worker;
+    }
+
+    return queue;
+}
+
+/*
+ * Shut down a work queue.  Work that is already queued
+ * is completed first.  Must be called by the thread which
+ * created the queue, since it joins the worker threads.
+ */
+void Destroy_Work_Queue(struct Work_Queue* queue)
+{
+    int i;
+
+    Mutex_Lock(&queue->lock);
+    queue->shutdown = true;
+    Cond_Broadcast(&queue->workAvailable);
+    Mutex_Unlock(&queue->lock);
+
+    for (i = 0; i < queue->numWorkers; ++i)
+	Join(queue->workers[i]);
+
+    Mutex_Unregister(&queue->lock);
+    Free(queue->workers);
+    Free(queue);
+}
+
+/*
+ * Initialize a work item which will call given function
+ * with given argument.
+ */
+void Init_Work(struct Work_Item* work, Work_Func func, ulong_t arg)
+{
+    work->func = func;
+    work->arg = arg;
+    work->queue = 0;
+    work->pending = false;
+    Cond_Init(&work->done);
+}
+
+/*
+ * Submit a work item to given queue.
+ * The item must not already be pending.
+ */
+void Queue_Work(struct Work_Queue* queue, struct Work_Item* work)
+{
+    Mutex_Lock(&queue->lock);
+    KASSERT(!work->pending);
+    KASSERT(!queue->shutdown);
+    work->queue = queue;
+    work->pending = true;
+    Add_To_Back_Of_Work_List(&queue->pendingList, work);
+    ++queue->numQueued;
+    Cond_Signal(&queue->workAvailable);
+    Mutex_Unlock(&queue->lock);
+}
+
+/*
+ * Wait until given work item has finished running.
+ * Returns immediately if it was never submitted.
+ */
+void Wait_For_Work(struct Work_Item* work)
+{
+    struct Work_Queue* queue = work->queue;
+
+    if (queue == 0)
+	return;
+
+    Mutex_Lock(&queue->lock);
+    while (work->pending)
+	Cond_Wait(&work->done, &queue->lock);
+    Mutex_Unlock(&queue->lock);
+}
@@ -0,0 +1,32 @@
+/*
+ * Included ahead of every kernel module built for the host
+ * (see src/tools/hosttest.c).  The string functions from
+ * src/common are renamed, so they don't replace the host C
+ * library's, and the test program can compare the two.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef HOSTSHIM_H
+#define HOSTSHIM_H
+
+#define memset   Geekos_memset
+#define memcpy   Geekos_memcpy
+#define memmove  Geekos_memmove
+#define memcmp   Geekos_memcmp
+#define strlen   Geekos_strlen
+#define strnlen  Geekos_strnlen
+#define strcmp   Geekos_strcmp
+#define strncmp  Geekos_strncmp
+#define strcat   Geekos_strcat
+#define strcpy   Geekos_strcpy
+#define strncpy  Geekos_strncpy
+#define strdup   Geekos_strdup
+#define atoi     Geekos_atoi
+#define strchr   Geekos_strchr
+#define strrchr  Geekos_strrchr
+#define strpbrk  Geekos_strpbrk
+#define snprintf Geekos_snprintf
+
+#endif  /* HOSTSHIM_H */
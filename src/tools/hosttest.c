@@ -0,0 +1,691 @@
+/*
+ * Host test and benchmark program for portable kernel modules
+ *
+ * bget.c, crc32.c, list.h and the common library (fmtout.c, string.c,
+ * memmove.c) don't depend on the hardware, so they are also built
+ * for the host and linked into this program, which runs randomized
+ * tests against them and measures their throughput.  See
+ * src/tools/hostshim.h and src/tools/include for the shims that
+ * make that possible.  Build and run it with "make host-test".
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <geekos/ktypes.h>
+#include <geekos/list.h>
+#include <geekos/bget.h>
+#include <geekos/crc32.h>
+
+/*
+ * The kernel's string functions, renamed by hostshim.h.
+ */
+void* Geekos_memset(void* s, int c, size_t n);
+void* Geekos_memcpy(void *dst, const void* src, size_t n);
+void* Geekos_memmove(void *dst, const void *src, size_t n);
+int Geekos_memcmp(const void *s1, const void *s2, size_t n);
+size_t Geekos_strlen(const char* s);
+int Geekos_snprintf(char *s, size_t size, const char *fmt, ...);
+
+/* ----------------------------------------------------------------------
+ * Shims for kernel services
+ * ---------------------------------------------------------------------- */
+
+void Host_Assert_Failed(const char* func, const char* cond, const char* file, int line)
+{
+    fprintf(stderr, "Failed assertion in %s: %s at %s, line %d\n", func, cond, file, line);
+    abort();
+}
+
+void* Malloc(size_t size)
+{
+    return malloc(size);
+}
+
+/* ----------------------------------------------------------------------
+ * Test support
+ * ---------------------------------------------------------------------- */
+
+static int s_numFailures;
+
+#define MAX_REPORTED_FAILURES 20
+
+static void Fail(const char* fmt, ...)
+{
+    va_list args;
+
+    if (++s_numFailures > MAX_REPORTED_FAILURES)
+	return;
+
+    printf("FAIL: ");
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+}
+
+/*
+ * Pseudo-random numbers (xorshift), so a failing run
+ * can be repeated with the same seed.
+ */
+static ulong_t s_random = 1;
+
+static ulong_t Random(void)
+{
+    s_random ^= s_random << 13;
+    s_random ^= s_random >> 7;
+    s_random ^= s_random << 17;
+    return s_random;
+}
+
+static ulong_t Random_Below(ulong_t limit)
+{
+    return Random() % limit;
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ----------------------------------------------------------------------
+ * list.h
+ * ---------------------------------------------------------------------- */
+
+#define NUM_NODES 64
+
+struct Test_Node;
+DEFINE_LIST(Test_List, Test_Node);
+
+struct Test_Node {
+    int value;
+    bool onList;
+    DEFINE_LINK(Test_List, Test_Node);
+};
+
+IMPLEMENT_LIST(Test_List, Test_Node);
+
+/*
+ * Apply random operations to a list and to an array
+ * modelling it, and check that they agree.
+ */
+static void Test_List(int rounds)
+{
+    struct Test_Node nodes[NUM_NODES];
+    int model[NUM_NODES];
+    int length = 0;
+    struct Test_List list;
+    int round, i;
+
+    memset(nodes, 0, sizeof(nodes));
+    for (i = 0; i < NUM_NODES; ++i)
+	nodes[i].value = i;
+    Clear_Test_List(&list);
+
+    for (round = 0; round < rounds; ++round) {
+	struct Test_Node* node = &nodes[Random_Below(NUM_NODES)];
+
+	switch (Random_Below(4)) {
+	case 0:
+	    if (node->onList)
+		break;
+	    Add_To_Front_Of_Test_List(&list, node);
+	    memmove(&model[1], &model[0], length * sizeof(int));
+	    model[0] = node->value;
+	    ++length;
+	    node->onList = true;
+	    break;
+	case 1:
+	    if (node->onList)
+		break;
+	    Add_To_Back_Of_Test_List(&list, node);
+	    model[length++] = node->value;
+	    node->onList = true;
+	    break;
+	case 2:
+	    if (!node->onList)
+		break;
+	    Remove_From_Test_List(&list, node);
+	    for (i = 0; model[i] != node->value; ++i)
+		;
+	    memmove(&model[i], &model[i + 1], (length - i - 1) * sizeof(int));
+	    --length;
+	    node->onList = false;
+	    break;
+	case 3:
+	    if (Is_Test_List_Empty(&list))
+		break;
+	    node = Remove_From_Front_Of_Test_List(&list);
+	    if (node->value != model[0])
+		Fail("list: removed %d from front, expected %d", node->value, model[0]);
+	    memmove(&model[0], &model[1], (length - 1) * sizeof(int));
+	    --length;
+	    node->onList = false;
+	    break;
+	}
+
+	/* Walk the list both ways */
+	i = 0;
+	for (node = Get_Front_Of_Test_List(&list); node != 0; node = Get_Next_In_Test_List(node)) {
+	    if (i >= length || node->value != model[i]) {
+		Fail("list: forward walk differs at position %d", i);
+		return;
+	    }
+	    ++i;
+	}
+	for (node = Get_Back_Of_Test_List(&list); node != 0; node = Get_Prev_In_Test_List(node)) {
+	    if (--i < 0 || node->value != model[i]) {
+		Fail("list: backward walk differs at position %d", i);
+		return;
+	    }
+	}
+	if (i != 0 || Is_Test_List_Empty(&list) != (length == 0))
+	    Fail("list: length differs from model (%d)", length);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * bget.c
+ * ---------------------------------------------------------------------- */
+
+#define POOL_SIZE (4 * 1024 * 1024)
+#define NUM_SLOTS 512
+#define MAX_ALLOC 8192
+
+static char* s_pool;
+
+struct Allocation {
+    unsigned char* buf;
+    bufsize size;
+    unsigned char fill;
+};
+
+static bool Check_Fill(struct Allocation* a)
+{
+    bufsize i;
+
+    for (i = 0; i < a->size; ++i) {
+	if (a->buf[i] != a->fill)
+	    return false;
+    }
+    return true;
+}
+
+/*
+ * Random sizes, mostly small, as in the kernel.
+ */
+static bufsize Random_Size(void)
+{
+    if (Random_Below(8) == 0)
+	return 1 + Random_Below(MAX_ALLOC);
+    return 1 + Random_Below(256);
+}
+
+/*
+ * Allocate, resize and free buffers at random, filling each with
+ * its own byte value, and check that no buffer is overwritten.
+ * bget's internal consistency checks (KASSERTs) are enabled too.
+ * At the end, everything is freed and the whole pool must be
+ * available as one block again.
+ */
+static void Test_Bget(int rounds)
+{
+    struct Allocation slots[NUM_SLOTS];
+    int round, i;
+    void* all;
+
+    memset(slots, 0, sizeof(slots));
+
+    for (round = 0; round < rounds; ++round) {
+	struct Allocation* a = &slots[Random_Below(NUM_SLOTS)];
+
+	if (a->buf != 0 && !Check_Fill(a)) {
+	    Fail("bget: buffer of %ld bytes at %p was overwritten", (long) a->size, a->buf);
+	    return;
+	}
+
+	switch (Random_Below(3)) {
+	case 0:
+	case 1:
+	    if (a->buf != 0) {
+		brel(a->buf);
+		a->buf = 0;
+		break;
+	    }
+	    a->size = Random_Size();
+	    a->buf = (Random_Below(2) == 0) ? bget(a->size) : bgetz(a->size);
+	    if (a->buf == 0) {
+		Fail("bget: allocation of %ld bytes failed", (long) a->size);
+		return;
+	    }
+	    a->fill = (unsigned char) Random();
+	    memset(a->buf, a->fill, a->size);
+	    break;
+	case 2:
+	    if (a->buf == 0)
+		break;
+	    {
+		bufsize newSize = Random_Size();
+		unsigned char* buf = bgetr(a->buf, newSize);
+		if (buf == 0) {
+		    Fail("bget: resize to %ld bytes failed", (long) newSize);
+		    return;
+		}
+		a->buf = buf;
+		if (newSize < a->size)
+		    a->size = newSize;
+		if (!Check_Fill(a))
+		    Fail("bget: resize lost the contents of a buffer");
+		a->size = newSize;
+		memset(a->buf, a->fill, a->size);
+	    }
+	    break;
+	}
+    }
+
+    for (i = 0; i < NUM_SLOTS; ++i) {
+	if (slots[i].buf != 0) {
+	    if (!Check_Fill(&slots[i]))
+		Fail("bget: buffer of %ld bytes was overwritten", (long) slots[i].size);
+	    brel(slots[i].buf);
+	}
+    }
+
+    /* Free blocks must have been merged back together */
+    all = bget(POOL_SIZE - 1024);
+    if (all == 0)
+	Fail("bget: pool is fragmented after freeing everything");
+    else
+	brel(all);
+}
+
+/* ----------------------------------------------------------------------
+ * fmtout.c
+ * ---------------------------------------------------------------------- */
+
+static const long s_edgeValues[] = {
+    0, 1, -1, 9, 10, 99, 100, 255, 256, 4095, 65535, 65536,
+    123456789, -123456789, INT_MAX, INT_MIN, UINT_MAX, LONG_MAX, LONG_MIN,
+};
+#define NUM_EDGE_VALUES (sizeof(s_edgeValues) / sizeof(s_edgeValues[0]))
+
+static const char* s_strings[] = {
+    "", "a", "hello", "GeekOS kernel", "0123456789abcdef0123456789",
+};
+#define NUM_STRINGS (sizeof(s_strings) / sizeof(s_strings[0]))
+
+static long Random_Value(void)
+{
+    switch (Random_Below(3)) {
+    case 0:
+	return s_edgeValues[Random_Below(NUM_EDGE_VALUES)];
+    case 1:
+	return (long) Random_Below(1000) - 500;
+    default:
+	return (long) Random();
+    }
+}
+
+/*
+ * Append random flags from given set, each at most once.
+ */
+static char* Add_Flags(char* p, const char* allowed)
+{
+    for (; *allowed != '\0'; ++allowed) {
+	if (Random_Below(4) == 0)
+	    *p++ = *allowed;
+    }
+    return p;
+}
+
+/*
+ * Format a value with a randomly generated conversion specification,
+ * both with the kernel's snprintf() and the host's, and compare.
+ * Only specifications whose meaning the C standard defines are used.
+ */
+static void Fuzz_One_Format(void)
+{
+    static const char conversions[] = "diuxXocs";
+    char format[64], expected[256], actual[256];
+    char conv = conversions[Random_Below(sizeof(conversions) - 1)];
+    bool isLong = false, starWidth = false, starPrecision = false;
+    int width = 0, precision = 0;
+    long value = Random_Value();
+    const char* str = s_strings[Random_Below(NUM_STRINGS)];
+    int ch = ' ' + (int) Random_Below(95);
+    size_t size = (Random_Below(8) == 0) ? Random_Below(16) : sizeof(actual);
+    int expectedLen = 0, actualLen = 0;
+    char* p = format;
+
+    if (Random_Below(2) == 0)
+	*p++ = '<';
+
+    *p++ = '%';
+    switch (conv) {
+    case 'd': case 'i': p = Add_Flags(p, "-+ 0"); break;
+    case 'u': p = Add_Flags(p, "-0"); break;
+    case 'x': case 'X': case 'o': p = Add_Flags(p, "-#0"); break;
+    default: p = Add_Flags(p, "-"); break;
+    }
+
+    switch (Random_Below(4)) {
+    case 0:
+	width = Random_Below(24);
+	p += sprintf(p, "%d", width);
+	break;
+    case 1:
+	starWidth = true;
+	width = (int) Random_Below(24) - 4;
+	*p++ = '*';
+	break;
+    }
+
+    if (conv != 'c') {
+	switch (Random_Below(4)) {
+	case 0:
+	    precision = Random_Below(16);
+	    p += sprintf(p, ".%d", precision);
+	    break;
+	case 1:
+	    starPrecision = true;
+	    precision = (int) Random_Below(20) - 4;
+	    p += sprintf(p, ".*");
+	    break;
+	}
+    }
+
+    if (conv != 'c' && conv != 's' && Random_Below(2) == 0) {
+	isLong = true;
+	*p++ = 'l';
+    }
+    *p++ = conv;
+    if (Random_Below(2) == 0)
+	*p++ = '>';
+    *p = '\0';
+
+/*
+ * Call both functions with the same arguments: the optional
+ * star width and precision, then the value itself.
+ */
+#define BOTH(arg)									\
+    do {										\
+	if (starWidth && starPrecision) {						\
+	    expectedLen = snprintf(expected, size, format, width, precision, arg);	\
+	    actualLen = Geekos_snprintf(actual, size, format, width, precision, arg);	\
+	} else if (starWidth) {								\
+	    expectedLen = snprintf(expected, size, format, width, arg);			\
+	    actualLen = Geekos_snprintf(actual, size, format, width, arg);		\
+	} else if (starPrecision) {							\
+	    expectedLen = snprintf(expected, size, format, precision, arg);		\
+	    actualLen = Geekos_snprintf(actual, size, format, precision, arg);		\
+	} else {									\
+	    expectedLen = snprintf(expected, size, format, arg);			\
+	    actualLen = Geekos_snprintf(actual, size, format, arg);			\
+	}										\
+    } while (0)
+
+    memset(expected, 'E', sizeof(expected));
+    memset(actual, 'E', sizeof(actual));
+
+    switch (conv) {
+    case 'd': case 'i':
+	if (isLong)
+	    BOTH(value);
+	else
+	    BOTH((int) value);
+	break;
+    case 'u': case 'x': case 'X': case 'o':
+	if (isLong)
+	    BOTH((unsigned long) value);
+	else
+	    BOTH((unsigned) value);
+	break;
+    case 'c':
+	BOTH(ch);
+	break;
+    case 's':
+	BOTH(str);
+	break;
+    }
+
+#undef BOTH
+
+    if (actualLen != expectedLen || (size > 0 && strcmp(actual, expected) != 0)) {
+	Fail("snprintf(size %lu, \"%s\", w=%d, p=%d, value=%ld): got %d \"%s\", expected %d \"%s\"",
+	    (ulong_t) size, format, width, precision, value,
+	    actualLen, size > 0 ? actual : "", expectedLen, size > 0 ? expected : "");
+    }
+}
+
+static void Test_Format(int rounds)
+{
+    int round;
+
+    for (round = 0; round < rounds; ++round)
+	Fuzz_One_Format();
+}
+
+/* ----------------------------------------------------------------------
+ * string.c, memmove.c and crc32.c
+ * ---------------------------------------------------------------------- */
+
+#define STRING_BUF_SIZE 512
+
+static void Test_Strings(int rounds)
+{
+    static const char* names[] = { "memcpy", "memmove", "memset", "strlen", "memcmp" };
+    static unsigned char a[STRING_BUF_SIZE], b[STRING_BUF_SIZE], other[STRING_BUF_SIZE];
+    int round;
+
+    for (round = 0; round < rounds; ++round) {
+	size_t i, n = Random_Below(STRING_BUF_SIZE / 2);
+	size_t src = Random_Below(STRING_BUF_SIZE / 2);
+	size_t dst = Random_Below(STRING_BUF_SIZE / 2);
+	int c = (int) Random_Below(256);
+	int op = (int) Random_Below(5);
+
+	for (i = 0; i < STRING_BUF_SIZE; ++i) {
+	    a[i] = b[i] = (unsigned char) Random();
+	    other[i] = (unsigned char) Random();
+	}
+
+	switch (op) {
+	case 0:
+	    Geekos_memcpy(a + dst, other + src, n);
+	    memcpy(b + dst, other + src, n);
+	    break;
+	case 1:
+	    Geekos_memmove(a + dst, a + src, n);
+	    memmove(b + dst, b + src, n);
+	    break;
+	case 2:
+	    Geekos_memset(a + dst, c, n);
+	    memset(b + dst, c, n);
+	    break;
+	case 3:
+	    a[dst + n] = b[dst + n] = '\0';
+	    for (i = dst; i < dst + n; ++i) {
+		if (a[i] == '\0')
+		    a[i] = b[i] = 'x';
+	    }
+	    if (Geekos_strlen((char*) a + dst) != n)
+		Fail("strlen: got %lu, expected %lu", (ulong_t) Geekos_strlen((char*) a + dst), (ulong_t) n);
+	    break;
+	case 4:
+	    /* Equal for a random prefix, which may be all n bytes */
+	    i = Random_Below(n + 1);
+	    memcpy(other + src, a + dst, i);
+	    {
+		int got = Geekos_memcmp(a + dst, other + src, n);
+		int expected = memcmp(a + dst, other + src, n);
+		if ((got < 0) != (expected < 0) || (got > 0) != (expected > 0))
+		    Fail("memcmp (n=%lu, equal prefix %lu): got %d, expected %d",
+			(ulong_t) n, (ulong_t) i, got, expected);
+	    }
+	    break;
+	}
+
+	if (memcmp(a, b, sizeof(a)) != 0) {
+	    Fail("%s (n=%lu, src=%lu, dst=%lu) gave the wrong result",
+		names[op], (ulong_t) n, (ulong_t) src, (ulong_t) dst);
+	    return;
+	}
+    }
+}
+
+static void Test_CRC32(void)
+{
+    static const char check[] = "123456789";
+    ulong_t crc = crc32(0, check, 9);
+
+    /* The standard check value for this CRC */
+    if (crc != 0xcbf43926UL)
+	Fail("crc32: check value is %lx, expected cbf43926", crc);
+
+    /* Checksumming in pieces must give the same result */
+    crc = crc32(crc32(0, check, 4), check + 4, 5);
+    if (crc != 0xcbf43926UL)
+	Fail("crc32: chained check value is %lx, expected cbf43926", crc);
+}
+
+/* ----------------------------------------------------------------------
+ * Benchmarks
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Run a benchmark body for about the given time,
+ * and report the time per operation.
+ */
+#define BENCH_SECONDS 0.25
+
+static volatile ulong_t s_sink;
+
+static void Report(const char* name, double seconds, long ops, double bytesPerOp)
+{
+    printf("%-24s %10.1f ns/op", name, seconds * 1e9 / ops);
+    if (bytesPerOp > 0)
+	printf(" %10.1f MB/s", bytesPerOp * ops / seconds / 1e6);
+    printf("\n");
+}
+
+#define BENCH(name, bytesPerOp, body)					\
+    do {								\
+	long _ops = 0, _batch = 1;					\
+	double _start = Now(), _elapsed;				\
+	do {								\
+	    long _i;							\
+	    for (_i = 0; _i < _batch; ++_i) {				\
+		body;							\
+	    }								\
+	    _ops += _batch;						\
+	    _batch *= 2;						\
+	    _elapsed = Now() - _start;					\
+	} while (_elapsed < BENCH_SECONDS);				\
+	Report((name), _elapsed, _ops, (bytesPerOp));			\
+    } while (0)
+
+static void Run_Benchmarks(void)
+{
+    static char src[4096], dst[4096], out[128];
+    static void* ptrs[64];
+    int i;
+
+    for (i = 0; i < (int) sizeof(src); ++i)
+	src[i] = (char) i;
+
+    BENCH("snprintf mixed", 0,
+	s_sink += Geekos_snprintf(out, sizeof(out), "pid=%d addr=%lx name=%s n=%u\n",
+	    (int) _i, (ulong_t) _i * 4099, "kthread", (unsigned) _i * 7));
+    BENCH("snprintf mixed (host)", 0,
+	s_sink += snprintf(out, sizeof(out), "pid=%d addr=%lx name=%s n=%u\n",
+	    (int) _i, (ulong_t) _i * 4099, "kthread", (unsigned) _i * 7));
+    BENCH("snprintf %d", 0,
+	s_sink += Geekos_snprintf(out, sizeof(out), "%d", (int) (_i * 2654435761UL)));
+    BENCH("snprintf %x", 0,
+	s_sink += Geekos_snprintf(out, sizeof(out), "%x", (unsigned) (_i * 2654435761UL)));
+    BENCH("snprintf %08x", 0,
+	s_sink += Geekos_snprintf(out, sizeof(out), "%08x", (unsigned) (_i * 2654435761UL)));
+    BENCH("snprintf literal", 0,
+	s_sink += Geekos_snprintf(out, sizeof(out), "a plain string without conversions\n"));
+
+    BENCH("memcpy 4k", sizeof(src), Geekos_memcpy(dst, src, sizeof(src)); s_sink += dst[_i & 4095]);
+    BENCH("memcpy 4k (host)", sizeof(src), memcpy(dst, src, sizeof(src)); s_sink += dst[_i & 4095]);
+    BENCH("memset 4k", sizeof(dst), Geekos_memset(dst, (int) _i, sizeof(dst)); s_sink += dst[_i & 4095]);
+    BENCH("memmove 4k overlap", sizeof(src) - 64, Geekos_memmove(src + 64, src, sizeof(src) - 64));
+    BENCH("strlen 4k", sizeof(src), memset(dst, 'x', sizeof(dst) - 1); dst[4095] = 0; s_sink += Geekos_strlen(dst));
+    BENCH("crc32 4k", sizeof(src), s_sink += crc32(0, src, sizeof(src)));
+
+    BENCH("bget/brel 64 bytes", 0, { void* p = bget(64); brel(p); });
+    memset(ptrs, 0, sizeof(ptrs));
+    BENCH("bget/brel random", 0, {
+	void** slot = &ptrs[Random_Below(64)];
+	if (*slot != 0) { brel(*slot); *slot = 0; }
+	else *slot = bget(Random_Size());
+    });
+    for (i = 0; i < 64; ++i) {
+	if (ptrs[i] != 0)
+	    brel(ptrs[i]);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Main program
+ * ---------------------------------------------------------------------- */
+
+static void Usage(void)
+{
+    fprintf(stderr, "Usage: hosttest [-t] [-b] [-s seed] [-n rounds]\n");
+    fprintf(stderr, "  -t  run tests only\n");
+    fprintf(stderr, "  -b  run benchmarks only\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    bool runTests = true, runBenchmarks = true;
+    ulong_t seed = (ulong_t) time(0);
+    int rounds = 200000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "tbs:n:")) != -1) {
+	switch (opt) {
+	case 't': runBenchmarks = false; break;
+	case 'b': runTests = false; break;
+	case 's': seed = strtoul(optarg, 0, 0); break;
+	case 'n': rounds = atoi(optarg); break;
+	default: Usage();
+	}
+    }
+    s_random = seed ? seed : 1;
+
+    Init_CRC32();
+    s_pool = malloc(POOL_SIZE);
+    bpool(s_pool, POOL_SIZE);
+
+    if (runTests) {
+	printf("Testing with seed %lu, %d rounds\n", seed, rounds);
+	Test_List(rounds);
+	Test_Bget(rounds);
+	Test_Format(rounds);
+	Test_Strings(rounds);
+	Test_CRC32();
+	if (s_numFailures > MAX_REPORTED_FAILURES)
+	    printf("(%d more failures not shown)\n", s_numFailures - MAX_REPORTED_FAILURES);
+	printf("%s: %d failures\n", s_numFailures ? "FAILED" : "PASSED", s_numFailures);
+    }
+
+    if (runBenchmarks)
+	Run_Benchmarks();
+
+    return s_numFailures ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * KASSERT() and friends for kernel modules built for the host
+ * (see src/tools/hosttest.c).  This header is found before
+ * include/geekos/kassert.h, so failed assertions end the test
+ * program with a message instead of hanging.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#ifndef GEEKOS_KASSERT_H
+#define GEEKOS_KASSERT_H
+
+void Host_Assert_Failed(const char* func, const char* cond, const char* file, int line)
+    __attribute__ ((noreturn));
+
+#define KASSERT(cond)						\
+do {								\
+    if (!(cond))						\
+	Host_Assert_Failed(__func__, #cond, __FILE__, __LINE__);\
+} while (0)
+
+#define TODO(message) Host_Assert_Failed(__func__, (message), __FILE__, __LINE__)
+#define PAUSE(count)
+#define STOP() Host_Assert_Failed(__func__, "STOP", __FILE__, __LINE__)
+#define Panic(args...) Host_Assert_Failed(__func__, "Panic", __FILE__, __LINE__)
+
+#endif  /* GEEKOS_KASSERT_H */
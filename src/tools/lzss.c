@@ -0,0 +1,261 @@
+/*
+ * LZSS compressor for the kernel image
+ *
+ * Builds the compressed kernel for fdz.img.  The format is meant to
+ * be trivial to decompress in the setup code (see setup.asm):
+ *
+ *   - a 32 bit little endian count of uncompressed bytes
+ *   - groups of a flag byte followed by up to 8 items; bit i of the
+ *     flag byte (least significant first) describes item i:
+ *       1: a literal byte
+ *       0: a 16 bit little endian match; the low 12 bits are the
+ *          distance back into the output minus 1, the high 4 bits
+ *          are the length minus LZSS_MIN_MATCH
+ *
+ * The decompressor stops once it has produced the uncompressed count.
+ *
+ * The boot sector loads the compressed image above the address the
+ * kernel is decompressed to, and the setup code decompresses it in
+ * place.  "lzss -m" prints how far above (a multiple of 512 bytes)
+ * so that the output never overwrites input that hasn't been read.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "COPYING".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LZSS_WINDOW_SIZE 4096
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + 15)
+
+#define HASH_BITS 13
+#define HASH_SIZE (1 << HASH_BITS)
+#define MAX_CHAIN 256
+
+#define SECTOR_SIZE 512
+
+static const char* s_progName;
+
+static void Usage(void)
+{
+    fprintf(stderr, "Usage: %s <input> <output>\n", s_progName);
+    fprintf(stderr, "       %s -m <input>\n", s_progName);
+    fprintf(stderr, "Compress a kernel image, or print the offset it must be\n");
+    fprintf(stderr, "loaded at to be decompressed in place\n");
+    exit(1);
+}
+
+static void Fatal(const char* msg, const char* name)
+{
+    fprintf(stderr, "%s: %s %s\n", s_progName, msg, name);
+    exit(1);
+}
+
+static unsigned char* Read_File(const char* name, size_t* size)
+{
+    FILE* fp = fopen(name, "rb");
+    unsigned char* buf;
+    long len;
+
+    if (fp == 0)
+	Fatal("couldn't open", name);
+    if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+	Fatal("couldn't get size of", name);
+
+    buf = malloc(len > 0 ? len : 1);
+    if (buf == 0)
+	Fatal("out of memory reading", name);
+    if (fread(buf, 1, len, fp) != (size_t) len)
+	Fatal("couldn't read", name);
+    fclose(fp);
+
+    *size = len;
+    return buf;
+}
+
+static unsigned Hash(const unsigned char* p)
+{
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/*
+ * Compress a buffer.  Returns the compressed image, including the
+ * header, and stores its size and the in-place decompression offset.
+ */
+static unsigned char* Compress(const unsigned char* in, size_t size,
+    size_t* outSize, size_t* loadOffset)
+{
+    /* Worst case is 9 bits per byte, plus the header */
+    unsigned char* out = malloc(4 + size + size / 8 + 2);
+    int* head = malloc(HASH_SIZE * sizeof(int));
+    int* prev = malloc((size > 0 ? size : 1) * sizeof(int));
+    size_t pos = 0, o = 4, flagPos = 0;
+    long margin = 0;
+    int nItems = 8;
+    int i;
+
+    if (out == 0 || head == 0 || prev == 0)
+	Fatal("out of memory compressing", "");
+
+    for (i = 0; i < HASH_SIZE; ++i)
+	head[i] = -1;
+
+    out[0] = size & 0xff;
+    out[1] = (size >> 8) & 0xff;
+    out[2] = (size >> 16) & 0xff;
+    out[3] = (size >> 24) & 0xff;
+
+    while (pos < size) {
+	size_t bestLen = 0, bestDist = 0, len, n;
+
+	if (nItems == 8) {
+	    flagPos = o++;
+	    out[flagPos] = 0;
+	    nItems = 0;
+	}
+
+	/* Find the longest match in the window */
+	if (pos + LZSS_MIN_MATCH <= size) {
+	    int cand = head[Hash(&in[pos])];
+	    int chain = MAX_CHAIN;
+	    size_t maxLen = size - pos < LZSS_MAX_MATCH ? size - pos : LZSS_MAX_MATCH;
+
+	    while (cand >= 0 && pos - cand <= LZSS_WINDOW_SIZE && chain-- > 0) {
+		for (len = 0; len < maxLen && in[cand + len] == in[pos + len]; ++len)
+		    ;
+		if (len > bestLen) {
+		    bestLen = len;
+		    bestDist = pos - cand;
+		    if (len == maxLen)
+			break;
+		}
+		cand = prev[cand];
+	    }
+	}
+
+	if (bestLen >= LZSS_MIN_MATCH) {
+	    unsigned token = (bestDist - 1) | ((bestLen - LZSS_MIN_MATCH) << 12);
+	    out[o++] = token & 0xff;
+	    out[o++] = token >> 8;
+	    n = bestLen;
+	} else {
+	    out[flagPos] |= 1 << nItems;
+	    out[o++] = in[pos];
+	    n = 1;
+	}
+	++nItems;
+
+	/* Add the positions we're skipping over to the hash chains */
+	while (n-- > 0) {
+	    if (pos + LZSS_MIN_MATCH <= size) {
+		unsigned h = Hash(&in[pos]);
+		prev[pos] = head[h];
+		head[h] = pos;
+	    }
+	    ++pos;
+	}
+
+	/*
+	 * Decompressing in place, the output written so far must end
+	 * at or before the next unread input byte.
+	 */
+	if ((long) pos - (long) o > margin)
+	    margin = (long) pos - (long) o;
+    }
+
+    free(head);
+    free(prev);
+
+    *outSize = o;
+    *loadOffset = (margin + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    return out;
+}
+
+/*
+ * Decompress in place the way setup.asm does, with the compressed
+ * image at the load offset in the same buffer, and check the result.
+ */
+static void Check(const unsigned char* orig, size_t size,
+    const unsigned char* comp, size_t compSize, size_t loadOffset)
+{
+    size_t bufSize = loadOffset + compSize > size ? loadOffset + compSize : size;
+    unsigned char* buf = malloc(bufSize);
+    const unsigned char* in;
+    unsigned char* out;
+    unsigned char* end;
+
+    if (buf == 0)
+	Fatal("out of memory checking", "");
+
+    memcpy(buf + loadOffset, comp, compSize);
+    in = buf + loadOffset + 4;
+    out = buf;
+    end = buf + size;
+
+    while (out < end) {
+	int flags = *in++;
+	int i;
+
+	for (i = 0; i < 8 && out < end; ++i) {
+	    if (flags & (1 << i)) {
+		*out++ = *in++;
+	    } else {
+		unsigned token = in[0] | (in[1] << 8);
+		size_t len = (token >> 12) + LZSS_MIN_MATCH;
+		const unsigned char* src = out - ((token & 0xfff) + 1);
+
+		in += 2;
+		while (len-- > 0)
+		    *out++ = *src++;
+	    }
+	    if (out > in)
+		Fatal("output overtook input in", "in-place decompression");
+	}
+    }
+
+    if (memcmp(buf, orig, size) != 0)
+	Fatal("decompressed image doesn't match", "input");
+
+    free(buf);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned char* in;
+    unsigned char* out;
+    size_t size, outSize, loadOffset;
+    FILE* fp;
+
+    s_progName = argv[0];
+
+    if (argc != 3)
+	Usage();
+
+    if (strcmp(argv[1], "-m") == 0) {
+	in = Read_File(argv[2], &size);
+	out = Compress(in, size, &outSize, &loadOffset);
+	printf("%lu\n", (unsigned long) loadOffset);
+	free(in);
+	free(out);
+	return 0;
+    }
+
+    in = Read_File(argv[1], &size);
+    out = Compress(in, size, &outSize, &loadOffset);
+    Check(in, size, out, outSize, loadOffset);
+
+    fp = fopen(argv[2], "wb");
+    if (fp == 0)
+	Fatal("couldn't create", argv[2]);
+    if (fwrite(out, 1, outSize, fp) != outSize || fclose(fp) != 0)
+	Fatal("couldn't write", argv[2]);
+
+    fprintf(stderr, "%s: %lu -> %lu bytes, load offset %lu\n", argv[2],
+	(unsigned long) size, (unsigned long) outSize, (unsigned long) loadOffset);
+    free(in);
+    free(out);
+    return 0;
+}